@@ -1,8 +1,10 @@
 #include "devices/block.h"
+#include <blockstat.h>
 #include <list.h>
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 
 /* A block device. */
@@ -17,8 +19,7 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    struct blockstat stats;             /* I/O accounting. */
   };
 
 /* List of all block devices. */
@@ -28,6 +29,8 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static uint64_t io_submit (struct block *);
+static void io_complete (struct block *, uint64_t start, bool write);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +123,12 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
+  uint64_t start;
+
   check_sector (block, sector);
+  start = io_submit (block);
   block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  io_complete (block, start, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +139,13 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
+  uint64_t start;
+
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
+  start = io_submit (block);
   block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  io_complete (block, start, true);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,6 +169,20 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Prints the nonzero buckets of latency histogram HIST, labeled
+   with NAME. */
+static void
+print_histogram (const char *name, const uint32_t hist[BLOCKSTAT_BUCKETS])
+{
+  int i;
+
+  printf ("  %s latency (log2 cycles):", name);
+  for (i = 0; i < BLOCKSTAT_BUCKETS; i++)
+    if (hist[i] != 0)
+      printf (" %d:%"PRIu32, i, hist[i]);
+  printf ("\n");
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
@@ -171,13 +194,46 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
+          struct blockstat *s = &block->stats;
+          uint64_t requests = s->read_cnt + s->write_cnt;
+
           printf ("%s (%s): %llu reads, %llu writes\n",
-                  block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->name, block_type_name (i),
+                  s->read_cnt, s->write_cnt);
+          if (requests == 0)
+            continue;
+          printf ("  %llu bytes read, %llu bytes written, "
+                  "avg depth %llu, max depth %"PRIu32"\n",
+                  s->read_bytes, s->write_bytes,
+                  s->depth_sum / requests, s->max_in_flight);
+          printf ("  avg read %llu cycles, avg write %llu cycles\n",
+                  s->read_cnt ? s->read_cycles / s->read_cnt : 0,
+                  s->write_cnt ? s->write_cycles / s->write_cnt : 0);
+          print_histogram ("read", s->read_hist);
+          print_histogram ("write", s->write_hist);
         }
     }
 }
 
+/* Copies the I/O statistics of the block device in the given
+   ROLE into *STATS.  Returns false if ROLE is out of range or no
+   device plays it. */
+bool
+block_get_stats (enum block_type role, struct blockstat *stats)
+{
+  enum intr_level old_level;
+  struct block *block;
+
+  if (role >= BLOCK_ROLE_CNT || block_by_role[role] == NULL)
+    return false;
+  block = block_by_role[role];
+
+  old_level = intr_disable ();
+  *stats = block->stats;
+  intr_set_level (old_level);
+  return true;
+}
+
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
@@ -198,8 +254,7 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  memset (&block->stats, 0, sizeof block->stats);
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -221,3 +276,73 @@ list_elem_to_block (struct list_elem *list_elem)
           : NULL);
 }
 
+
+/* Returns the CPU time-stamp counter. */
+static uint64_t
+read_tsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Returns the histogram bucket for a request that took CYCLES. */
+static int
+latency_bucket (uint64_t cycles)
+{
+  int bucket = 0;
+
+  while (cycles > 1 && bucket < BLOCKSTAT_BUCKETS - 1)
+    {
+      cycles >>= 1;
+      bucket++;
+    }
+  return bucket;
+}
+
+/* Accounts for a request being submitted to BLOCK and returns
+   its start time, to be passed to io_complete(). */
+static uint64_t
+io_submit (struct block *block)
+{
+  struct blockstat *s = &block->stats;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  s->in_flight++;
+  s->depth_sum += s->in_flight;
+  if (s->in_flight > s->max_in_flight)
+    s->max_in_flight = s->in_flight;
+  intr_set_level (old_level);
+
+  return read_tsc ();
+}
+
+/* Accounts for a one-sector request to BLOCK, submitted at time
+   START, having completed.  WRITE tells its direction. */
+static void
+io_complete (struct block *block, uint64_t start, bool write)
+{
+  struct blockstat *s = &block->stats;
+  uint64_t cycles = read_tsc () - start;
+  int bucket = latency_bucket (cycles);
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  s->in_flight--;
+  if (write)
+    {
+      s->write_cnt++;
+      s->write_bytes += BLOCK_SECTOR_SIZE;
+      s->write_cycles += cycles;
+      s->write_hist[bucket]++;
+    }
+  else
+    {
+      s->read_cnt++;
+      s->read_bytes += BLOCK_SECTOR_SIZE;
+      s->read_cycles += cycles;
+      s->read_hist[bucket]++;
+    }
+  intr_set_level (old_level);
+}
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <stdbool.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -57,7 +58,9 @@ const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
 /* Statistics. */
+struct blockstat;
 void block_print_stats (void);
+bool block_get_stats (enum block_type role, struct blockstat *);
 
 /* Lower-level interface to block device drivers. */
 
@@ -0,0 +1,104 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A block device whose sectors live in kernel memory.
+
+   The RAM disk is registered as a raw block device named "rd0".
+   It is given a Pintos role the same way as any other device,
+   with the -filesys=rd0 or -scratch=rd0 kernel options.  Its
+   contents are lost at shutdown, which makes it useful for
+   benchmarking the file system and buffer cache without IDE
+   latency, and for fast temporary storage. */
+
+/* Number of sectors that fit in one page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    size_t page_cnt;            /* Number of pages in PAGES. */
+    void **pages;               /* Backing pages, one per 8 sectors. */
+    struct lock lock;           /* Serializes sector copies. */
+  };
+
+static struct ramdisk ramdisk;
+
+static struct block_operations ramdisk_operations;
+
+/* Creates a RAM disk of SIZE_KB kilobytes, rounded up to a whole
+   number of pages, and registers it as block device "rd0".  Does
+   nothing if SIZE_KB is 0.  Backing pages are taken one at a
+   time from the kernel pool, so the disk does not need to be
+   physically contiguous.  Panics if the kernel pool runs out. */
+void
+ramdisk_init (size_t size_kb)
+{
+  block_sector_t size;
+  size_t i;
+
+  if (size_kb == 0)
+    return;
+
+  ramdisk.page_cnt = DIV_ROUND_UP (size_kb * 1024, PGSIZE);
+  ramdisk.pages = calloc (ramdisk.page_cnt, sizeof *ramdisk.pages);
+  if (ramdisk.pages == NULL)
+    PANIC ("Failed to allocate RAM disk page table");
+  for (i = 0; i < ramdisk.page_cnt; i++)
+    {
+      ramdisk.pages[i] = palloc_get_page (PAL_ZERO);
+      if (ramdisk.pages[i] == NULL)
+        PANIC ("RAM disk of %zu kB does not fit in the kernel pool "
+               "(ran out after %zu kB)", size_kb, i * PGSIZE / 1024);
+    }
+  lock_init (&ramdisk.lock);
+
+  size = ramdisk.page_cnt * SECTORS_PER_PAGE;
+  block_register ("rd0", BLOCK_RAW, "RAM disk", size,
+                  &ramdisk_operations, &ramdisk);
+}
+
+/* Returns the address in memory of SECTOR within RD. */
+static uint8_t *
+sector_addr (struct ramdisk *rd, block_sector_t sector)
+{
+  return ((uint8_t *) rd->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads sector SEC_NO from the RAM disk RD_ into BUFFER, which
+   must have room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_read (void *rd_, block_sector_t sec_no, void *buffer)
+{
+  struct ramdisk *rd = rd_;
+
+  lock_acquire (&rd->lock);
+  memcpy (buffer, sector_addr (rd, sec_no), BLOCK_SECTOR_SIZE);
+  lock_release (&rd->lock);
+}
+
+/* Writes sector SEC_NO of the RAM disk RD_ from BUFFER, which
+   must contain BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_write (void *rd_, block_sector_t sec_no, const void *buffer)
+{
+  struct ramdisk *rd = rd_;
+
+  lock_acquire (&rd->lock);
+  memcpy (sector_addr (rd, sec_no), buffer, BLOCK_SECTOR_SIZE);
+  lock_release (&rd->lock);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write
+  };
@@ -20,6 +20,38 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Pending timers live in a hierarchical timer wheel of
+   WHEEL_LEVELS levels with WHEEL_SLOTS slots each.  A timer that
+   expires less than WHEEL_SLOTS ticks from now goes in the level-0
+   slot of its tick; one that expires later goes in a coarser level,
+   WHEEL_BITS more bits of the tick per level, and is moved down a
+   level ("cascaded") when the wheel reaches its slot.  Adding a
+   timer is O(1), and each tick only looks at the timers that are
+   due plus, every WHEEL_SLOTS ticks, the timers of one coarser
+   slot. */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+static struct list wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+
+/* Next tick the wheel will run.  Every pending timer expires at
+   or after it. */
+static int64_t wheel_next;
+
+/* While the idle thread is the only thread that can run, the PIT
+   is programmed for a single period that ends at the next tick the
+   wheel has work for, instead of interrupting every tick.  The
+   ticks that pass meanwhile are accounted for when that period
+   ends or another interrupt cuts it short, by running the tick
+   work once for each of them.  The 16-bit PIT counter limits the
+   period to IDLE_MAX_TICKS ticks. */
+#define PIT_TICK ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+#define IDLE_MAX_TICKS (UINT16_MAX / PIT_TICK)
+
+/* Ticks the current PIT period spans, or 0 if the PIT is
+   interrupting every tick. */
+static int idle_ticks;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
@@ -29,12 +61,25 @@ static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static void wheel_insert (struct timer *);
+static void wheel_cascade (int level, int64_t tick);
+static void wheel_run (int64_t tick);
+static void wake_thread (void *t_);
+static int wheel_idle_ticks (int max);
+static void tick (void);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SLOTS; slot++)
+      list_init (&wheel[level][slot]);
+  wheel_next = 1;
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -90,10 +135,67 @@ void
 timer_sleep (int64_t ticks) 
 {
   int64_t start = timer_ticks ();
+  struct timer timer;
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  if (timer_elapsed (start) < ticks) 
-    thread_sleep (start+ticks);
+  if (ticks <= 0)
+    return;
+
+  old_level = intr_disable ();
+  timer_set (&timer, start + ticks, wake_thread, thread_current ());
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Timer function used by timer_sleep(). */
+static void
+wake_thread (void *t_) 
+{
+  thread_unblock (t_);
+}
+
+/* Arranges for FUNC (AUX) to be called from the timer interrupt
+   once timer_ticks() reaches EXPIRES, or at the next tick if
+   EXPIRES has already passed.  TIMER must not be pending already,
+   and it must stay allocated until
+   FUNC has been called or timer_cancel() has returned. */
+void
+timer_set (struct timer *timer, int64_t expires, timer_func *func, void *aux)
+{
+  enum intr_level old_level;
+
+  ASSERT (timer != NULL);
+  ASSERT (func != NULL);
+
+  old_level = intr_disable ();
+  timer->expires = expires;
+  timer->func = func;
+  timer->aux = aux;
+  timer->pending = true;
+  wheel_insert (timer);
+  intr_set_level (old_level);
+}
+
+/* Cancels TIMER.  Returns true if it was still pending, false if
+   its function has already been called. */
+bool
+timer_cancel (struct timer *timer) 
+{
+  enum intr_level old_level;
+  bool pending;
+
+  ASSERT (timer != NULL);
+
+  old_level = intr_disable ();
+  pending = timer->pending;
+  if (pending)
+    {
+      list_remove (&timer->elem);
+      timer->pending = false;
+    }
+  intr_set_level (old_level);
+  return pending;
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -166,14 +268,189 @@ timer_print_stats (void)
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
+/* Called by the idle thread, with interrupts off, just before it
+   halts.  Stops the periodic tick until the wheel next has work,
+   if that is at least two ticks away. */
+void
+timer_idle_enter (void) 
+{
+  int n;
+  uint16_t left;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (idle_ticks != 0)
+    return;
+  n = wheel_idle_ticks (IDLE_MAX_TICKS);
+  if (n < 2)
+    return;
+
+  /* Keep the period aligned with the tick it replaces: it ends
+     where the Nth tick from now would have.  If the current tick
+     is already due, let it be delivered as usual. */
+  left = pit_read_counter (0);
+  if (left < 2 || intr_pending (0x20))
+    return;
+  idle_ticks = n;
+  pit_configure_count (0, 2, left + (n - 1) * PIT_TICK);
+}
+
+/* Called for every external interrupt other than the timer's.
+   If the idle thread stopped the periodic tick, accounts for the
+   ticks that have passed and arranges for the next interrupt to
+   arrive when the current tick ends. */
+void
+timer_idle_exit (void) 
+{
+  uint16_t left;
+  int whole;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (idle_ticks <= 1)
+    return;
+
+  /* Read the counter before checking for a pending interrupt: if
+     the period ended in between, the interrupt shows up as
+     pending and the handler accounts for the whole period. */
+  left = pit_read_counter (0);
+  if (intr_pending (0x20))
+    return;
+
+  /* WHOLE ticks remain after the one in progress.  Those that
+     have passed are run now; the new period ends with the one in
+     progress and stands for it alone, the rest arriving as usual
+     once the periodic tick resumes. */
+  whole = (left - 1) / PIT_TICK;
+  left -= whole * PIT_TICK;
+  while (idle_ticks - 1 > whole)
+    {
+      idle_ticks--;
+      tick ();
+    }
+  idle_ticks = 1;
+  pit_configure_count (0, 2, left < 2 ? 2 : left);
+}
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
+{
+  /* A stretched period stands for IDLE_TICKS ticks. */
+  if (idle_ticks != 0)
+    {
+      pit_configure_channel (0, 2, TIMER_FREQ);
+      while (--idle_ticks > 0)
+        tick ();
+    }
+  tick ();
+}
+
+/* Does the work of one timer tick. */
+static void
+tick (void) 
 {
   ticks++;
   thread_tick ();
   thread_update_stats(ticks);
-  thread_wake(ticks);
+  wheel_run (ticks);
+}
+
+/* Returns how many ticks, from 1 up to MAX, the PIT may stay
+   quiet: only the last of them may expire a timer or cascade the
+   wheel. */
+static int
+wheel_idle_ticks (int max) 
+{
+  int n;
+
+  for (n = 1; n < max; n++)
+    {
+      int64_t t = wheel_next + n - 1;
+      if ((t & (WHEEL_SLOTS - 1)) == 0
+          || !list_empty (&wheel[0][t & (WHEEL_SLOTS - 1)]))
+        break;
+    }
+  return n;
+}
+
+/* Puts pending TIMER in the wheel slot for its expiry time. */
+static void
+wheel_insert (struct timer *timer) 
+{
+  int64_t expires = timer->expires;
+  int64_t delta;
+  int level;
+
+  if (expires < wheel_next)
+    expires = wheel_next;
+  delta = expires - wheel_next;
+
+  /* Timers beyond the reach of the wheel wait in the last slot the
+     top level can reach and are placed again when it cascades. */
+  if (delta >= (int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+    expires = wheel_next + ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      break;
+  list_push_back (&wheel[level][(expires >> (WHEEL_BITS * level))
+                                & (WHEEL_SLOTS - 1)],
+                  &timer->elem);
+}
+
+/* Moves the timers in the LEVEL slot that the wheel reaches at
+   TICK down to finer levels. */
+static void
+wheel_cascade (int level, int64_t tick) 
+{
+  struct list *slot = &wheel[level][(tick >> (WHEEL_BITS * level))
+                                    & (WHEEL_SLOTS - 1)];
+  struct list timers;
+
+  list_init (&timers);
+  while (!list_empty (slot))
+    list_push_back (&timers, list_pop_front (slot));
+  while (!list_empty (&timers))
+    wheel_insert (list_entry (list_pop_front (&timers), struct timer, elem));
+}
+
+/* Calls the functions of the timers that expire at TICK.  Runs in
+   the timer interrupt handler. */
+static void
+wheel_run (int64_t tick) 
+{
+  struct list *slot;
+  struct list due;
+  int level;
+
+  ASSERT (tick == wheel_next);
+
+  /* Each time a level wraps around, pull down the next slot of
+     the level above. */
+  for (level = 1; level < WHEEL_LEVELS; level++)
+    {
+      if ((tick & (((int64_t) 1 << (WHEEL_BITS * level)) - 1)) != 0)
+        break;
+      wheel_cascade (level, tick);
+    }
+
+  /* Take the due timers out first, so that a timer function that
+     sets a timer again does not land in the slot being run. */
+  slot = &wheel[0][tick & (WHEEL_SLOTS - 1)];
+  list_init (&due);
+  while (!list_empty (slot))
+    list_push_back (&due, list_pop_front (slot));
+  wheel_next = tick + 1;
+
+  while (!list_empty (&due))
+    {
+      struct timer *timer = list_entry (list_pop_front (&due),
+                                        struct timer, elem);
+      ASSERT (timer->expires <= tick);
+      timer->pending = false;
+      timer->func (timer->aux);
+    }
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
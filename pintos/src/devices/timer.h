@@ -1,7 +1,9 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
@@ -26,4 +28,23 @@ void timer_ndelay (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+/* Tickless idle. */
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
+/* Timer callbacks.  FUNC runs in the timer interrupt handler, with
+   interrupts off, so it must not sleep. */
+typedef void timer_func (void *aux);
+struct timer
+  {
+    struct list_elem elem;      /* Element in a timer wheel slot. */
+    int64_t expires;            /* Tick at which to call FUNC. */
+    timer_func *func;           /* Function to call. */
+    void *aux;                  /* Auxiliary data for FUNC. */
+    bool pending;               /* Set until FUNC is called. */
+  };
+
+void timer_set (struct timer *, int64_t expires, timer_func *, void *aux);
+bool timer_cancel (struct timer *);
+
 #endif /* devices/timer.h */
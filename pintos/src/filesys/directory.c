@@ -5,6 +5,7 @@
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
 /* A directory. */
@@ -22,6 +23,8 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+static bool do_add (struct dir *, const char *name, block_sector_t);
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -134,10 +137,12 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  rwlock_acquire_read (&dir->inode->dir_lock);
   if (lookup (dir, name, &e, NULL))
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
+  rwlock_release_read (&dir->inode->dir_lock);
 
   return *inode != NULL;
 }
@@ -150,6 +155,21 @@ dir_lookup (const struct dir *dir, const char *name,
    error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
+{
+  bool success;
+
+  journal_begin ();
+  rwlock_acquire_write (&dir->inode->dir_lock);
+  success = do_add (dir, name, inode_sector);
+  rwlock_release_write (&dir->inode->dir_lock);
+  journal_end ();
+  return success;
+}
+
+/* Does the work of dir_add().  The caller holds DIR's lock for
+   writing, inside a journal operation. */
+static bool
+do_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
   struct dir_entry e;
   off_t ofs;
@@ -164,7 +184,7 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
-    goto done;
+    return false;
 
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
@@ -183,8 +203,6 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-
- done:
   return success;
 }
 
@@ -202,6 +220,7 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  rwlock_acquire_write (&dir->inode->dir_lock);
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -221,6 +240,7 @@ dir_remove (struct dir *dir, const char *name)
   success = true;
 
  done:
+  rwlock_release_write (&dir->inode->dir_lock);
   inode_close (inode);
   return success;
 }
@@ -232,17 +252,21 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool found = false;
 
+  rwlock_acquire_read (&dir->inode->dir_lock);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          found = true;
+          break;
         } 
     }
-  return false;
+  rwlock_release_read (&dir->inode->dir_lock);
+  return found;
 }
 
 char* dir_parse_next(char* path,char* next){
@@ -316,17 +340,27 @@ bool dir_mkdir(char* dir_name){
   char* name = calloc(1,NAME_MAX+1);
   struct inode* inode; 
   struct dir* current_dir = dir_open_by_path(dir_name, name); 
-  struct dir_entry* ep; 
-  off_t *ofsp;
+  /* the journal operation comes before the lock, see journal.c */
+  journal_begin();
+  /* nobody may add NAME between the check and the add */
+  rwlock_acquire_write(&current_dir->inode->dir_lock);
   // duplicate directory name 
-  if(lookup(current_dir,name,ep,ofsp)){
+  if(lookup(current_dir,name,NULL,NULL)){
+    rwlock_release_write(&current_dir->inode->dir_lock);
+    journal_end();
     return false; 
   }
   block_sector_t sector; 
-  if(!free_map_allocate(1,&sector))
+  /* directories go to the emptiest group */
+  if(!free_map_allocate_near(1,free_map_spread_goal(),&sector)){
+    rwlock_release_write(&current_dir->inode->dir_lock);
+    journal_end();
     return false; 
+  }
   dir_create(sector,16);
-  dir_add(current_dir,name,sector);
+  do_add(current_dir,name,sector);
+  rwlock_release_write(&current_dir->inode->dir_lock);
+  journal_end();
   return true;
 }
 bool dir_chdir(const char* dir_name){
@@ -113,6 +113,45 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Writes FILE's dirty data to disk.  Unless DATA_ONLY, also
+   makes all of FILE's metadata durable; with DATA_ONLY, only the
+   metadata needed to read the data back (its length and block
+   map) is written, and only if it changed. */
+void
+file_sync (struct file *file, bool data_only)
+{
+  ASSERT (file != NULL);
+  inode_sync (file->inode, data_only);
+}
+
+/* Allocates disk space for LENGTH bytes of FILE starting at
+   OFFSET, growing FILE if needed, so that writing them later
+   cannot fail for lack of space.  Returns true if successful. */
+bool
+file_allocate (struct file *file, off_t offset, off_t length) 
+{
+  ASSERT (file != NULL);
+  return inode_allocate (file->inode, offset, length);
+}
+
+/* Sets the length of FILE to LENGTH bytes, freeing the disk space
+   past it if FILE shrinks.  Returns true if successful. */
+bool
+file_truncate (struct file *file, off_t length) 
+{
+  ASSERT (file != NULL);
+  return inode_truncate (file->inode, length);
+}
+
+/* Moves the data of FILE into consecutive sectors.  Returns true
+   if successful. */
+bool
+file_defrag (struct file *file) 
+{
+  ASSERT (file != NULL);
+  return inode_defrag (file->inode);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -1,6 +1,7 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stdbool.h>
 #include "filesys/off_t.h"
 
 struct inode;
@@ -17,6 +18,14 @@ off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
 
+/* Durability. */
+void file_sync (struct file *, bool data_only);
+
+/* Preallocation and truncation. */
+bool file_allocate (struct file *, off_t offset, off_t length);
+bool file_truncate (struct file *, off_t length);
+bool file_defrag (struct file *);
+
 /* Preventing writes. */
 void file_deny_write (struct file *);
 void file_allow_write (struct file *);
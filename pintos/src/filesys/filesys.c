@@ -6,6 +6,7 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
 
@@ -31,6 +32,8 @@ filesys_init (bool format)
   if (format) 
     do_format ();
 
+  /* replay committed metadata before anything reads it */
+  journal_open ();
   free_map_open ();
 }
 
@@ -39,7 +42,9 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
-  /* write all dirty buffers from cache to disk */
+  /* finish freeing removed files, then write all dirty buffers
+     from cache to disk and commit the metadata */
+  inode_reclaim_sync ();
   buffer_flush_all();
   free_map_close ();
   
@@ -62,12 +67,17 @@ filesys_create (const char *name, off_t initial_size )
     dir_close(dir);
     return false;
   }
+  journal_begin ();
+  /* the new inode goes in its directory's group */
   bool success = (dir!=NULL
-  		  && free_map_allocate (1, &inode_sector)
+  		  && free_map_allocate_near (1,
+  		                             inode_get_inumber (dir_get_inode (dir)),
+  		                             &inode_sector)
   		  && inode_create (inode_sector, initial_size,0)
   		  && dir_add (dir, filename, inode_sector));
    if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
+  journal_end ();
   dir_close (dir);
   return success;   
 }
@@ -101,7 +111,9 @@ bool
 filesys_remove (const char *name) 
 {
   struct dir *dir = dir_open_root(); 
+  journal_begin ();
   bool success = dir!=NULL && dir_remove(dir,name);
+  journal_end ();
   dir_close (dir); 
   return success;
 }
@@ -112,6 +124,7 @@ do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
+  journal_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
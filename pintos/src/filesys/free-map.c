@@ -1,52 +1,379 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
+#include <list.h>
+#include <round.h>
 #include <debug.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
+/* Sectors freed by a journal transaction that has not committed
+   yet.  They are free in the map written to disk, but a crash
+   before the commit brings back the block map that points to
+   them, so they must keep their contents until then and are not
+   handed out: they stay set in ALLOC_MAP, which allocations are
+   made from, until the journal commits past SEQ. */
+struct held_run
+  {
+    struct list_elem elem;              /* Element in HELD_RUNS. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    unsigned seq;                       /* Transaction that freed them. */
+  };
+
+/* FREE_MAP_LOCK protects everything below.  Writing the free map
+   file may evict a buffer whose data still needs a sector, which
+   allocates one, so the holder may come back in. */
+static struct lock free_map_lock;
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *alloc_map;     /* FREE_MAP plus the held sectors. */
+static struct list held_runs;        /* Held sectors, oldest first. */
+static size_t free_cnt;              /* Number of sectors that can be
+                                        allocated. */
+static size_t reserved_cnt;          /* Free sectors promised to
+                                        delayed allocations. */
+static struct bitmap *dirty_map;     /* Sectors of the free map file
+                                        that differ from FREE_MAP. */
+
+/* Number of free map bits in one sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Sectors a reservation of CNT leaves free for the indirect
+   blocks that allocating the reserved sectors may need. */
+#define RESERVE_SLACK(CNT) ((CNT) / 64 + 4)
+
+/* Sets the CNT bits of FREE_MAP starting at SECTOR to VALUE and
+   notes which sectors of the free map file they live in.
+   FREE_MAP_LOCK must be held. */
+static void
+free_map_set (block_sector_t sector, size_t cnt, bool value)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  ASSERT (cnt > 0);
+  bitmap_set_multiple (free_map, sector, cnt, value);
+  bitmap_set_multiple (dirty_map, first, last - first + 1, true);
+}
+
+/* Writes the sectors of the free map file that changed since
+   they were last written, and only those, so that an allocation
+   or release journals one or two sectors rather than the whole
+   map, and adds to the caller's journal operation no more than
+   the sectors its bits live in.  Returns false if a sector could not be written; it stays
+   marked and is written next time.  FREE_MAP_LOCK must be held. */
+static bool
+free_map_flush (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t i;
+
+  if (free_map_file == NULL)
+    return true;
+  /* Writing a sector may come back in here, see FREE_MAP_LOCK, so
+     each sector is claimed before it is written. */
+  while ((i = bitmap_scan_and_flip (dirty_map, 0, 1, true)) != BITMAP_ERROR)
+    {
+      size_t start = i * BITS_PER_SECTOR;
+      size_t cnt = size - start < BITS_PER_SECTOR ? size - start
+                                                  : BITS_PER_SECTOR;
+      if (!bitmap_write_range (free_map, free_map_file, start, cnt))
+        {
+          bitmap_mark (dirty_map, i);
+          return false;
+        }
+    }
+  return true;
+}
+
+/* Acquires FREE_MAP_LOCK unless the running thread already holds
+   it.  Returns true if it was acquired here. */
+static bool
+free_map_lock_acquire (void)
+{
+  if (lock_held_by_current_thread (&free_map_lock))
+    return false;
+  lock_acquire (&free_map_lock);
+  return true;
+}
+
+/* Releases FREE_MAP_LOCK if free_map_lock_acquire() returned
+   LOCKED. */
+static void
+free_map_lock_release (bool locked)
+{
+  if (locked)
+    lock_release (&free_map_lock);
+}
+
+/* Makes the held sectors whose transaction has committed
+   available.  FREE_MAP_LOCK must be held. */
+static void
+release_held (void)
+{
+  unsigned running = journal_running ();
+
+  while (!list_empty (&held_runs))
+    {
+      struct held_run *h = list_entry (list_front (&held_runs),
+                                       struct held_run, elem);
+      if (h->seq >= running)
+        break;
+      list_pop_front (&held_runs);
+      bitmap_set_multiple (alloc_map, h->sector, h->cnt, false);
+      free_cnt += h->cnt;
+      free (h);
+    }
+}
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  lock_init (&free_map_lock);
   free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
+  alloc_map = bitmap_create (block_size (fs_device));
+  dirty_map = bitmap_create (DIV_ROUND_UP (block_size (fs_device),
+                                           BITS_PER_SECTOR));
+  if (free_map == NULL || alloc_map == NULL || dirty_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, JOURNAL_SECTOR);
+  bitmap_mark (alloc_map, FREE_MAP_SECTOR);
+  bitmap_mark (alloc_map, ROOT_DIR_SECTOR);
+  bitmap_mark (alloc_map, JOURNAL_SECTOR);
+  list_init (&held_runs);
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
+  reserved_cnt = 0;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
    sectors were available or if the free_map file could not be
-   written. */
+   written.  Reserved sectors are not handed out. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* Like free_map_allocate(), but takes the first run of CNT free
+   sectors at or after GOAL, wrapping around to the start of the
+   disk if there is none.  Passing a sector in the group that
+   related data lives in keeps the new sectors in that group, or
+   failing that in the nearest group after it that has room.
+   Sectors freed by a transaction that has not committed are not
+   handed out. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t goal,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector;
+  bool locked = free_map_lock_acquire ();
+  bool success = free_map_claim (cnt, goal, &sector);
+
+  if (success)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      free_map_set (sector, cnt, true);
+      success = free_map_flush ();
+      if (success)
+        *sectorp = sector;
+      else
+        {
+          free_map_set (sector, cnt, false);
+          free_map_unclaim (sector, cnt);
+        }
     }
+  free_map_lock_release (locked);
+  return success;
+}
+
+/* Like free_map_allocate_near(), but sets the run aside in memory
+   only.  The free map file is not written, so the sectors stay
+   free on disk and a crash gives them back, but nothing else is
+   handed them until free_map_take() marks them allocated, a part
+   at a time if need be, or free_map_unclaim() gives back the ones
+   that were not.  For runs too long for one journal operation to
+   mark. */
+bool
+free_map_claim (size_t cnt, block_sector_t goal, block_sector_t *sectorp)
+{
+  block_sector_t sector;
+  bool locked = free_map_lock_acquire ();
+
+  release_held ();
+  if (free_cnt < reserved_cnt + cnt)
+    {
+      free_map_lock_release (locked);
+      return false;
+    }
+  if (goal >= bitmap_size (alloc_map))
+    goal = 0;
+  sector = bitmap_scan (alloc_map, goal, cnt, false);
+  if (sector == BITMAP_ERROR && goal != 0)
+    sector = bitmap_scan (alloc_map, 0, cnt, false);
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+    {
+      bitmap_set_multiple (alloc_map, sector, cnt, true);
+      free_cnt -= cnt;
+      *sectorp = sector;
+    }
+  free_map_lock_release (locked);
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Marks CNT sectors starting at SECTOR, set aside by
+   free_map_claim(), allocated in the free map file. */
+void
+free_map_take (block_sector_t sector, size_t cnt)
+{
+  bool locked = free_map_lock_acquire ();
+
+  ASSERT (bitmap_all (alloc_map, sector, cnt));
+  ASSERT (bitmap_none (free_map, sector, cnt));
+  free_map_set (sector, cnt, true);
+  free_map_flush ();
+  free_map_lock_release (locked);
+}
+
+/* Gives back CNT sectors starting at SECTOR that were set aside by
+   free_map_claim() and not taken. */
+void
+free_map_unclaim (block_sector_t sector, size_t cnt)
+{
+  bool locked = free_map_lock_acquire ();
+
+  ASSERT (bitmap_all (alloc_map, sector, cnt));
+  ASSERT (bitmap_none (free_map, sector, cnt));
+  bitmap_set_multiple (alloc_map, sector, cnt, false);
+  free_cnt += cnt;
+  free_map_lock_release (locked);
+}
+
+/* Returns the first sector of the block group with the most free
+   sectors, the lowest such group if several tie.  New directories
+   start there, so that directory trees spread over the disk and
+   leave room near each directory for its files. */
+block_sector_t
+free_map_spread_goal (void)
+{
+  size_t size = bitmap_size (alloc_map);
+  size_t best = 0, best_free = 0;
+  size_t start;
+  bool locked = free_map_lock_acquire ();
+
+  release_held ();
+  for (start = 0; start < size; start += FREE_MAP_GROUP_SECTORS)
+    {
+      size_t len = size - start < FREE_MAP_GROUP_SECTORS
+                   ? size - start : FREE_MAP_GROUP_SECTORS;
+      size_t group_free = bitmap_count (alloc_map, start, len, false);
+      if (group_free > best_free)
+        {
+          best = start;
+          best_free = group_free;
+        }
+    }
+  free_map_lock_release (locked);
+  return best;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use, once
+   the running journal transaction has committed. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  bool locked = free_map_lock_acquire ();
+  unsigned seq = journal_running ();
+  struct held_run *h;
+
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_map_set (sector, cnt, false);
+  if (seq == 0)
+    {
+      bitmap_set_multiple (alloc_map, sector, cnt, false);
+      free_cnt += cnt;
+    }
+  else if ((h = malloc (sizeof *h)) != NULL)
+    {
+      h->sector = sector;
+      h->cnt = cnt;
+      h->seq = seq;
+      list_push_back (&held_runs, &h->elem);
+    }
+  /* Otherwise the sectors stay unusable until the next boot,
+     which is safe. */
+  free_map_flush ();
+  free_map_lock_release (locked);
+}
+
+/* Sets aside CNT free sectors, without choosing which, for data
+   that will be allocated later.  Returns false if the disk does
+   not have that many sectors to spare. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool locked = free_map_lock_acquire ();
+  bool success;
+
+  release_held ();
+  success = free_cnt >= reserved_cnt + cnt
+            + RESERVE_SLACK (reserved_cnt + cnt);
+  if (success)
+    reserved_cnt += cnt;
+  free_map_lock_release (locked);
+  return success;
+}
+
+/* Like free_map_allocate_near(), but takes the CNT sectors out of
+   those set aside by free_map_reserve(), which are not handed out
+   otherwise.  The reservation stays if the allocation fails. */
+bool
+free_map_allocate_reserved (size_t cnt, block_sector_t goal,
+                            block_sector_t *sectorp)
+{
+  bool locked = free_map_lock_acquire ();
+  bool success;
+
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  success = free_map_allocate_near (cnt, goal, sectorp);
+  if (!success)
+    reserved_cnt += cnt;
+  free_map_lock_release (locked);
+  return success;
+}
+
+/* Returns CNT sectors set aside by free_map_reserve() that are no
+   longer needed. */
+void
+free_map_unreserve (size_t cnt)
+{
+  bool locked = free_map_lock_acquire ();
+
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  free_map_lock_release (locked);
+}
+
+/* Returns true if sectors freed by a transaction that has not
+   committed yet are waiting to become available. */
+bool
+free_map_held (void)
+{
+  bool locked = free_map_lock_acquire ();
+  bool held;
+
+  release_held ();
+  held = !list_empty (&held_runs);
+  free_map_lock_release (locked);
+  return held;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -56,8 +383,11 @@ free_map_open (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_read (free_map, free_map_file))
+  if (!bitmap_read (free_map, free_map_file)
+      || !bitmap_read (alloc_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (dirty_map, false);
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -72,14 +402,21 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
-  /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map),0))
+  struct inode *inode;
+  off_t size = bitmap_file_size (free_map);
+
+  /* Create inode and give it all its sectors up front, so that
+     writing the map never allocates. */
+  if (!inode_create (FREE_MAP_SECTOR, size, 0)
+      || (inode = inode_open (FREE_MAP_SECTOR)) == NULL
+      || !inode_allocate (inode, 0, size))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
+  free_map_file = file_open (inode);
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_map, false);
 }
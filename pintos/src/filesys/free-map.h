@@ -5,6 +5,10 @@
 #include <stddef.h>
 #include "devices/block.h"
 
+/* Sectors per block group.  Allocations that pass a goal stay in
+   the goal's group while it has room. */
+#define FREE_MAP_GROUP_SECTORS 1024
+
 void free_map_init (void);
 void free_map_read (void);
 void free_map_create (void);
@@ -12,6 +16,16 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (size_t, block_sector_t goal, block_sector_t *);
+bool free_map_claim (size_t, block_sector_t goal, block_sector_t *);
+void free_map_take (block_sector_t, size_t);
+void free_map_unclaim (block_sector_t, size_t);
+block_sector_t free_map_spread_goal (void);
 void free_map_release (block_sector_t, size_t);
+bool free_map_reserve (size_t);
+bool free_map_allocate_reserved (size_t, block_sector_t goal,
+                                 block_sector_t *);
+void free_map_unreserve (size_t);
+bool free_map_held (void);
 
 #endif /* filesys/free-map.h */
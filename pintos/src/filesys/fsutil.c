@@ -223,3 +223,19 @@ fsutil_append (char **argv)
   file_close (src);
   free (buffer);
 }
+
+/* Moves the data of file ARGV[1] into consecutive sectors. */
+void
+fsutil_defrag (char **argv) 
+{
+  const char *file_name = argv[1];
+  struct file *file;
+
+  printf ("Defragmenting '%s'...\n", file_name);
+  file = filesys_open (file_name);
+  if (file == NULL)
+    PANIC ("%s: open failed", file_name);
+  if (!file_defrag (file))
+    PANIC ("%s: defragmentation failed", file_name);
+  file_close (file);
+}
@@ -2,22 +2,51 @@
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #include "devices/timer.h"
 #include "threads/thread.h"
+#include "threads/workqueue.h"
 #include "devices/block.h"
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 #define WRITE_BEHIND_ALARM 100*TIMER_FREQ
+/* at most this many buffers wait for delayed allocation, so that
+   together with the journal's they leave buffers to evict */
+#define DELALLOC_MAX 24
+/* where inline file data starts in the inode sector */
+#define INLINE_OFS offsetof(struct inode_disk,inline_data)
+/* most sectors inode_free_map_allocate() takes in one run, so
+   that a run changes at most two sectors of the free map */
+#define ALLOCATE_RUN 512
+/* most sectors installing one block in the block map adds to a
+   journal operation: the inode and, at each level, a pointer block
+   and the free map sector a new one comes from */
+#define INSTALL_CREDITS (1 + 2 * BLOCK_MAP_LEVELS)
+/* most sectors freeing one block adds: the free map sector it goes
+   back to, the inode and, at each level, the pointer block that
+   held it and the free map sector of one it leaves empty */
+#define RELEASE_CREDITS (2 + 2 * BLOCK_MAP_LEVELS)
 
 /* array of 64 buffer heads */
 static struct buffer_head buffer_heads[64]; 
 /* list of buffer blocks */
 static struct list buffer_cache; 
 static struct list_elem* cache_hand;
+/* number of buffers waiting for delayed allocation or being
+   written back once they got it */
+static int delalloc_cnt;
+/* protects the three above and which sector or delayed block each
+   buffer holds.  Taken after the inode locks and the free map's,
+   and held across eviction, but not across reading a sector in. */
+static struct lock cache_lock;
+/* a sector of zeros */
+static char zeros[BLOCK_SECTOR_SIZE];
 struct buffer_head* get_buffer_head(block_sector_t sector);
 struct buffer_head* find_buffer_head(void);
 struct buffer_head* find_empty_buffer(void);
@@ -28,25 +57,67 @@ void buffer_read(struct buffer_head* buffer_head, void* buffer, off_t ofs, int c
 void buffer_read(struct buffer_head* buffer_head, void* buffer, off_t ofs, int chunk_size);
 static void buffer_direct_read(struct buffer_head* buffer_head, void* buffer, off_t ofs, int chunk_size);
 static void buffer_direct_write(struct buffer_head* buffer_head, void* buffer, off_t ofs, int chunk_size);
+static void buffer_writeback(struct buffer_head* entry, block_sector_t owner);
+static struct buffer_head* buffer_alloc(void);
+static struct buffer_head* buffer_get_new(block_sector_t sector);
+static struct buffer_head* buffer_find_delalloc(struct inode* inode, size_t idx);
+static struct buffer_head* buffer_new_delalloc(struct inode* inode, size_t idx);
+static void buffer_drop_delalloc(struct buffer_head* entry);
+static void buffer_forget(block_sector_t sector);
+static void buffer_flush_delalloc(void);
+static bool buffer_delalloc_full(void);
+static bool inode_flush_delalloc(struct inode* inode);
+static void inode_flush_delalloc_all(struct inode* inode);
 struct buffer_head* buffer_get(block_sector_t sector);
 void buffer_flush_all(void);
 void write_behind(void* aux);
-bool inode_free_map_allocate(size_t cnt, size_t old,struct inode_disk* inode_disk);
-void inode_free_map_deallocate(struct inode_disk* inode_disk);
+
+/* a removed inode whose blocks have yet to be freed */
+struct reclaim
+  {
+    struct list_elem elem;
+    block_sector_t sector;		/* inode sector */
+  };
+static struct list reclaim_list;
+static struct lock reclaim_lock;	/* protects the two below */
+static struct condition reclaim_idle;	/* nothing left to reclaim */
+static int reclaiming;			/* inodes being reclaimed */
+static struct work reclaim_work;	/* drains RECLAIM_LIST */
+static void reclaim_run(void* aux);
+/* periodic flush of the buffer cache */
+static struct work write_behind_work;
+static void inode_reclaim(block_sector_t sector);
+static bool inode_reclaim_wait(void);
+static bool inode_wait_space(void);
+static off_t inode_do_write_at(struct inode* inode, const void* buffer_, off_t size, off_t offset);
+static bool inode_unline(struct inode* inode);
 void cache_init(void){
   int i;
+  /* buffers in the running transaction and delayed allocation
+     buffers cannot be evicted; the rest of the cache always can */
+  ASSERT(JOURNAL_TX_CREDITS + DELALLOC_MAX < 64);
   list_init(&buffer_cache);  
   cache_hand = NULL;
+  delalloc_cnt = 0;
+  lock_init(&cache_lock);
   for ( i =0; i<64; i++){
     lock_init(&buffer_heads[i].extend_lock);
-    lock_init(&buffer_heads[i].evict_lock);
-    cond_init(&buffer_heads[i].accessed);
-    cond_init(&buffer_heads[i].evicted);
-    buffer_heads[i].accessing = false;
-    buffer_heads[i].evicting = false;
+    rwlock_init(&buffer_heads[i].evict_lock);
+    buffer_heads[i].journaled = false;
+    buffer_heads[i].owner = BUFFER_NO_OWNER;
+    buffer_heads[i].delalloc = NULL;
+    buffer_heads[i].pinned = false;
+    if((buffer_heads[i].data = malloc(BLOCK_SECTOR_SIZE)) == NULL)
+      PANIC("out of memory for the buffer cache");
     //list_push_back(&buffer_cache, &buffer_heads[i].elem);
   }
-  thread_create("write_behind",PRI_DEFAULT,write_behind,NULL);
+  work_init(&write_behind_work,write_behind,NULL,PRI_DEFAULT);
+  work_queue_delayed(&write_behind_work,WRITE_BEHIND_ALARM);
+  list_init(&reclaim_list);
+  lock_init(&reclaim_lock);
+  cond_init(&reclaim_idle);
+  reclaiming = 0;
+  work_init(&reclaim_work,reclaim_run,NULL,PRI_DEFAULT);
 }
 /* read the buffer block specified by BUFFER_HEAD into BUFFER */
 static void buffer_direct_read(struct buffer_head* buffer_head, void* buffer, off_t ofs, int chunk_size){
@@ -69,6 +140,19 @@ static void buffer_direct_write(struct buffer_head* buffer_head, void* buffer, o
   buffer_head->dirty = true; 
 }
 
+/* write metadata (an inode or an indirect block) from BUFFER to
+   BUFFER_HEAD and add it to the running journal transaction */
+static void buffer_write_meta(struct buffer_head* buffer_head, void* buffer, off_t ofs, int chunk_size){
+  buffer_write(buffer_head,buffer,ofs,chunk_size);
+  journal_add(buffer_head);
+}
+
+/* directories and the free map are metadata, their data blocks
+   are journaled */
+static bool inode_is_metadata(const struct inode* inode){
+  return inode->is_dir || inode->sector == FREE_MAP_SECTOR;
+}
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -77,352 +161,390 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* read INODE's on-disk inode into INODE_DISK and return the block
+   map generation the copy reflects */
+static unsigned inode_load_disk(struct inode* inode, struct inode_disk* inode_disk){
+  unsigned map_gen = inode->map_gen;
+  buffer_read(buffer_get(inode->sector),(void*)inode_disk,0,BLOCK_SECTOR_SIZE);
+  inode_disk->self_sector = inode->sector;
+  return map_gen;
+}
+
+/* write FIELD, which the caller just changed in its copy
+   INODE_DISK, through to the on-disk inode.  The other fields are
+   left alone, since the copy may be stale. */
+static void inode_disk_update(struct inode_disk* inode_disk, void* field, size_t size){
+  struct buffer_head* inode_head = buffer_get(inode_disk->self_sector);
+  buffer_write_meta(inode_head,field,(uint8_t*)field-(uint8_t*)inode_disk,size);
+}
 
+/* Block map.  Logical block IDX of a file is found through the
+   direct table or through one of the indirect, doubly indirect and
+   triply indirect blocks of its inode_disk, a radix tree of
+   pointer blocks with INDIRECT_BLOCK_ENTRIES entries each.  An
+   entry of 0 means that the block has no sector: sector 0 holds
+   the free map inode and is never part of a file.  Such a block is
+   a hole and reads as zeros; so is every block under a missing
+   pointer block. */
 
+/* find the slot of INODE_DISK that roots block IDX, and the
+   indices PATH to follow from it through the pointer blocks.
+   Returns the number of pointer blocks on the way, -1 if IDX is
+   past the largest file */
+static int block_map_path(struct inode_disk* inode_disk, size_t idx, block_sector_t** root, size_t path[]){
+  block_sector_t* roots[BLOCK_MAP_LEVELS] = {&inode_disk->indirect_block_sec,
+					     &inode_disk->double_indirect_block_sec,
+					     &inode_disk->triple_indirect_block_sec};
+  size_t span = 1;
+  int levels, l;
 
-static block_sector_t direct_sec_idx(off_t ofs)
-{
-  return (ofs/BLOCK_SECTOR_SIZE);
+  if(idx < DIRECT_BLOCK_ENTRIES){
+    *root = &inode_disk->direct_map_table[idx];
+    return 0;
+  }
+  idx -= DIRECT_BLOCK_ENTRIES;
+  for(levels = 1; levels <= BLOCK_MAP_LEVELS; levels++){
+    span *= INDIRECT_BLOCK_ENTRIES;
+    if(idx < span){
+      *root = roots[levels-1];
+      for(l = levels - 1; l >= 0; l--){
+	path[l] = idx % INDIRECT_BLOCK_ENTRIES;
+	idx /= INDIRECT_BLOCK_ENTRIES;
+      }
+      return levels;
+    }
+    idx -= span;
+  }
+  return -1;
 }
-static block_sector_t indirect_sec_idx(off_t ofs)
-{
-  return (ofs - BLOCK_SECTOR_SIZE*DIRECT_BLOCK_ENTRIES)/(BLOCK_SECTOR_SIZE);
+
+/* entry I of pointer block BLOCK */
+static block_sector_t pointer_get(block_sector_t block, size_t i){
+  block_sector_t sector;
+  struct buffer_head* entry = buffer_get(block);
+  buffer_read(entry,(void*)&sector,i*sizeof sector,sizeof sector);
+  return sector;
 }
-static block_sector_t d_indirect_sec_idx_first(off_t ofs) 
-{
-  return (ofs - BLOCK_SECTOR_SIZE*(DIRECT_BLOCK_ENTRIES+INDIRECT_BLOCK_ENTRIES))/(BLOCK_SECTOR_SIZE * INDIRECT_BLOCK_ENTRIES);
+
+static void pointer_set(block_sector_t block, size_t i, block_sector_t sector){
+  struct buffer_head* entry = buffer_get(block);
+  buffer_write_meta(entry,(void*)&sector,i*sizeof sector,sizeof sector);
 }
-static block_sector_t d_indirect_sec_idx_second(off_t ofs) 
-{
-  return (ofs - BLOCK_SECTOR_SIZE*(DIRECT_BLOCK_ENTRIES+INDIRECT_BLOCK_ENTRIES))%(BLOCK_SECTOR_SIZE * INDIRECT_BLOCK_ENTRIES);
-}
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns UINT_MAX if INODE does not contain data for a byte at offset
-   POS. */
-static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
-{
-  ASSERT (inode != NULL);
-  block_sector_t result = (block_sector_t)(-1);; 
-  struct buffer_head* inode_disk_head = buffer_get(inode->sector);
-  struct inode_disk* inode_disk = calloc(1,sizeof(struct inode_disk));
-  buffer_read(inode_disk_head,(void*) inode_disk,0,BLOCK_SECTOR_SIZE);
-
-  if(pos>=inode_disk->length)
-    goto done;
-  block_sector_t idx = direct_sec_idx(pos); 
-  /* a direct block */ 
-  if (idx < DIRECT_BLOCK_ENTRIES){ 
-    result = inode_disk->direct_map_table[idx];
-    goto done; 
+
+/* allocate a pointer block with every entry 0, near GOAL, return
+   its sector or 0 if the disk is full */
+static block_sector_t pointer_block_new(block_sector_t goal){
+  block_sector_t sector;
+  if(!free_map_allocate_near(1,goal,&sector))
+    return 0;
+  journal_add(buffer_get_new(sector));
+  return sector;
+}
+
+/* the sector holding block IDX of INODE_DISK, 0 if there is none.
+   INODE, if not NULL, remembers the last pointer block the lookup
+   went through, so that the next lookup of a nearby block reads
+   one pointer block instead of walking down from the root. */
+static block_sector_t block_map_lookup(struct inode* inode, struct inode_disk* inode_disk, size_t idx){
+  block_sector_t* root;
+  size_t path[BLOCK_MAP_LEVELS];
+  int levels = block_map_path(inode_disk,idx,&root,path);
+  block_sector_t sector, leaf_sector;
+  size_t leaf_base;
+  enum intr_level old_level;
+  int l;
+
+  if(levels < 0)
+    return 0;
+  if(levels > 1 && inode != NULL){
+    old_level = intr_disable();
+    leaf_base = inode->leaf_base;
+    leaf_sector = inode->leaf_sector;
+    intr_set_level(old_level);
+    if(leaf_sector != 0 && idx >= leaf_base
+       && idx - leaf_base < INDIRECT_BLOCK_ENTRIES)
+      return pointer_get(leaf_sector,path[levels-1]);
+  }
+  sector = *root;
+  for(l = 0; l < levels && sector != 0; l++){
+    if(l == levels - 1 && levels > 1 && inode != NULL){
+      old_level = intr_disable();
+      inode->leaf_base = idx - path[l];
+      inode->leaf_sector = sector;
+      intr_set_level(old_level);
+    }
+    sector = pointer_get(sector,path[l]);
+  }
+  return sector;
+}
+
+/* make SECTOR block IDX of INODE_DISK, allocating pointer blocks
+   on the way.  Both the copy and the on-disk inode are updated. */
+static bool block_map_install(struct inode_disk* inode_disk, size_t idx, block_sector_t sector){
+  block_sector_t* root;
+  size_t path[BLOCK_MAP_LEVELS];
+  int levels = block_map_path(inode_disk,idx,&root,path);
+  block_sector_t block, next;
+  int l;
+
+  if(levels < 0)
+    return false;
+  if(levels == 0){
+    *root = sector;
+    inode_disk_update(inode_disk,root,sizeof *root);
+    return true;
   }	
+  if(*root == 0){
+    if((*root = pointer_block_new(inode_disk->self_sector)) == 0)
+      return false;
+    inode_disk_update(inode_disk,root,sizeof *root);
+  }
+  block = *root;
+  for(l = 0; l < levels - 1; l++){
+    next = pointer_get(block,path[l]);
+    if(next == 0){
+      if((next = pointer_block_new(inode_disk->self_sector)) == 0)
+	return false;
+      pointer_set(block,path[l],next);
+    }
+    block = next;
+  }
+  pointer_set(block,path[levels-1],sector);
+  return true;
+}
  
-  block_sector_t indirect_idx = indirect_sec_idx(pos);
-  /* an indirect block */ 
-  if( indirect_idx < INDIRECT_BLOCK_ENTRIES) 
-    {
-      struct buffer_head* entry = buffer_get(inode_disk->indirect_block_sec); 
-      /* read the indirect block */
-      block_sector_t* indirect_block= calloc(1,BLOCK_SECTOR_SIZE); 
-      buffer_read(entry,(void*)indirect_block,0,BLOCK_SECTOR_SIZE);
-      result = indirect_block[indirect_idx]; 
-      free(indirect_block);
-      goto done;
+/* where block IDX of INODE_DISK should go: right after block
+   IDX - 1, or else right after the inode, so that a file's data
+   stays in its inode's group and in order */
+static block_sector_t block_map_goal(struct inode_disk* inode_disk, size_t idx){
+  block_sector_t prev = idx > 0 ? block_map_lookup(NULL,inode_disk,idx-1) : 0;
+  return (prev != 0 ? prev : inode_disk->self_sector) + 1;
+}
+
+/* free the blocks from KEEP on under pointer block BLOCK, which
+   maps the blocks from BASE on through LEVELS levels of pointer
+   blocks, last first, together with the pointer blocks that this
+   empties.  Stops, clearing *DONE, when the journal operation has
+   no room to free another block.  Returns true if BLOCK itself was
+   freed. */
+static bool block_map_trim(block_sector_t block, int levels, size_t base, size_t keep, bool* done){
+  block_sector_t* table;
+  size_t span = 1;
+  size_t i, first;
+  int l;
+
+  if(base >= keep && journal_room() < RELEASE_CREDITS){
+    *done = false;
+    return false;
+  }
+  if(levels == 0){
+    if(base < keep)
+      return false;
+    free_map_release(block,1);
+    return true;
+  }
+  for(l = 1; l < levels; l++)
+    span *= INDIRECT_BLOCK_ENTRIES;
+  if((table = malloc(BLOCK_SECTOR_SIZE)) == NULL)
+    PANIC("out of memory freeing file blocks");
+  buffer_read(buffer_get(block),(void*)table,0,BLOCK_SECTOR_SIZE);
+  /* children wholly before KEEP stay */
+  first = base >= keep ? 0 : (keep - base) / span;
+  for(i = INDIRECT_BLOCK_ENTRIES; i-- > first && *done; )
+    if(table[i] != 0 && block_map_trim(table[i],levels-1,base+i*span,keep,done))
+      pointer_set(block,i,0);
+  free(table);
+  if(base < keep || !*done)
+    return false;
+  free_map_release(block,1);
+  return true;
+}
+
+/* free the blocks of INODE_DISK from block KEEP on, last first, and
+   the pointer blocks left empty, updating the on-disk inode, for as
+   long as the journal operation has room.  Returns true if it got
+   down to block KEEP, false if the rest must be freed in another
+   operation. */
+static bool inode_disk_trim(struct inode_disk* inode_disk, size_t keep){
+  block_sector_t* roots[BLOCK_MAP_LEVELS] = {&inode_disk->indirect_block_sec,
+					     &inode_disk->double_indirect_block_sec,
+					     &inode_disk->triple_indirect_block_sec};
+  size_t base[BLOCK_MAP_LEVELS], span[BLOCK_MAP_LEVELS];
+  size_t i;
+  bool done = true;
+  int l;
+
+  for(l = 0; l < BLOCK_MAP_LEVELS; l++){
+    span[l] = l == 0 ? INDIRECT_BLOCK_ENTRIES : span[l-1] * INDIRECT_BLOCK_ENTRIES;
+    base[l] = l == 0 ? DIRECT_BLOCK_ENTRIES : base[l-1] + span[l-1];
+  }
+  for(l = BLOCK_MAP_LEVELS - 1; l >= 0 && done; l--){
+    block_sector_t* root = roots[l];
+    if(*root != 0 && base[l] + span[l] > keep
+       && block_map_trim(*root,l+1,base[l],keep,&done)){
+      *root = 0;
+      inode_disk_update(inode_disk,root,sizeof *root);
+    }
+  }
+  for(i = DIRECT_BLOCK_ENTRIES; i-- > keep && done; ){
+    block_sector_t* slot = &inode_disk->direct_map_table[i];
+    if(*slot == 0)
+      continue;
+    if(journal_room() < RELEASE_CREDITS){
+      done = false;
+      break;
     }
+    free_map_release(*slot,1);
+    *slot = 0;
+    inode_disk_update(inode_disk,slot,sizeof *slot);
+  }
+  return done;
+}
 
-  /* a doubly indirect block */ 
-  else if (idx < D_INDIRECT_BLOCK_ENTRIES)
-    {
-      int first_idx = d_indirect_sec_idx_first(pos);
-      int second_idx = d_indirect_sec_idx_second(pos);
-      /* read first level sector */ 
-      struct buffer_head* first_entry = buffer_get(inode_disk->double_indirect_block_sec);
-      block_sector_t* first_indirect = calloc(1,BLOCK_SECTOR_SIZE);
-      buffer_read(first_entry, (void*) first_indirect,0,BLOCK_SECTOR_SIZE);
-      /* read second level sector */ 
-      struct buffer_head* second_entry = buffer_get(first_indirect[first_idx]); 
-      block_sector_t* second_indirect =  calloc(1,BLOCK_SECTOR_SIZE); 
-      buffer_read(second_entry,(void*) second_indirect,0,BLOCK_SECTOR_SIZE); 
-      result = second_indirect[second_idx]; 
-      free(first_indirect);
-      free(second_indirect);
-      goto done;
-    }
- done:
-  free(inode_disk);
-  return result; 
+/* Extent cache.  Each open inode keeps the last few runs of its
+   block map that lookups resolved, so that reading or writing an
+   allocated block usually needs neither the on-disk inode nor any
+   pointer block.  Only allocated blocks are cached: a block's
+   sector does not change until it is freed, and freeing blocks
+   clears the cache. */
+
+/* the sector of block IDX of INODE if the extent cache knows it, 0
+   otherwise */
+static block_sector_t extent_lookup(struct inode* inode, size_t idx){
+  struct block_extent hit;
+  enum intr_level old_level = intr_disable();
+  block_sector_t sector = 0;
+  int i;
+
+  for(i = 0; i < INODE_EXTENTS && inode->extents[i].len != 0; i++){
+    if(idx >= inode->extents[i].idx
+       && idx - inode->extents[i].idx < inode->extents[i].len){
+      hit = inode->extents[i];
+      memmove(&inode->extents[1],&inode->extents[0],i*sizeof hit);
+      inode->extents[0] = hit;
+      sector = hit.sector + (idx - hit.idx);
+      break;
+    }
+  }
+  intr_set_level(old_level);
+  return sector;
+}
+
+/* record that block IDX of INODE is in SECTOR, growing a cached
+   run if the block continues it */
+static void extent_insert(struct inode* inode, size_t idx, block_sector_t sector){
+  struct block_extent* e;
+  enum intr_level old_level = intr_disable();
+  int i;
+
+  for(i = 0; i < INODE_EXTENTS && inode->extents[i].len != 0; i++){
+    e = &inode->extents[i];
+    if(idx == e->idx + e->len && sector == e->sector + e->len){
+      e->len++;
+      intr_set_level(old_level);
+      return;
+    }
+    if(idx + 1 == e->idx && sector + 1 == e->sector){
+      e->idx--;
+      e->sector--;
+      e->len++;
+      intr_set_level(old_level);
+      return;
+    }
+  }
+  memmove(&inode->extents[1],&inode->extents[0],
+	  (INODE_EXTENTS-1)*sizeof inode->extents[0]);
+  inode->extents[0].idx = idx;
+  inode->extents[0].sector = sector;
+  inode->extents[0].len = 1;
+  intr_set_level(old_level);
+}
+
+/* forget every cached mapping of INODE; called when blocks are
+   freed */
+static void inode_forget_map(struct inode* inode){
+  enum intr_level old_level = intr_disable();
+  int i;
+  for(i = 0; i < INODE_EXTENTS; i++)
+    inode->extents[i].len = 0;
+  inode->leaf_sector = 0;
+  intr_set_level(old_level);
 }
 
 /* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
+   returns the same `struct inode'.  Lookups hold OPEN_INODES_LOCK
+   for reading, insertions and removals for writing.  Open counts
+   change with interrupts off, since the readers share them. */
 static struct list open_inodes;
+static struct rwlock open_inodes_lock;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  rwlock_init (&open_inodes_lock);
 }
 
-/* given total number of sectors CNT, determine how many direct blocks,indirect blocks,how many indirect blocks in the doubly indirect block and how many blocks are in the last blocks of doubly indirect block*/ 
-static void sectors_divide(size_t cnt, size_t* direct, size_t* indirect, size_t* d_indirect_blocks,size_t* d_indirect_in_last){
-
-  *indirect = 0; 
-  *d_indirect_blocks = 0; 
-  *d_indirect_in_last = 0; 
-  if(cnt<=DIRECT_BLOCK_ENTRIES){
-    *direct = cnt;
-    return; 
-  }
-  *direct = DIRECT_BLOCK_ENTRIES; 
-  size_t remaining = cnt - DIRECT_BLOCK_ENTRIES; 
-  if ( remaining <= INDIRECT_BLOCK_ENTRIES){
-    *indirect = remaining; 
-    return; 
-  }
-  *indirect = INDIRECT_BLOCK_ENTRIES; 
-  remaining = remaining - INDIRECT_BLOCK_ENTRIES; 
-  *d_indirect_blocks = remaining / INDIRECT_BLOCK_ENTRIES; 
-  size_t remainder = remaining % INDIRECT_BLOCK_ENTRIES; 
-  if (remainder!=0){
-    *d_indirect_blocks += 1;
-    *d_indirect_in_last = remainder; 
-    return; 
-  }
-  return; 
-}
-
-/* allocate in total CNT sectors for INODE_DISK which has OLD sectors
-   allocated already */
-bool inode_free_map_allocate(size_t cnt,size_t old,struct inode_disk* inode_disk){
-  size_t direct_blocks = 0; 
-  size_t indirect_blocks = 0; 
-  size_t d_indirect_blocks = 0;
-  size_t d_indirect_in_last = 0;
-
-  size_t o_direct_blocks = 0; 
-  size_t o_indirect_blocks = 0; 
-  size_t o_d_indirect_blocks = 0;
-  size_t o_d_indirect_in_last = 0;
-
-  size_t i,j;
-  size_t allocated;
-  bool extend; 
-  /* if the inode was allocated before-->file extension*/
-  if(old!=0){
-    extend=true;
-  }
-  /* check how many sectors are allocated in each region */ 
-  sectors_divide(old,&o_direct_blocks,&o_indirect_blocks,
-		 &o_d_indirect_blocks,&o_d_indirect_in_last); 
-  sectors_divide(cnt,&direct_blocks,&indirect_blocks,
-		 &d_indirect_blocks,&d_indirect_in_last); 
-  /* allocate direct blocks */ 
- for(i=o_direct_blocks;i<direct_blocks;i++){
-    if(free_map_allocate(1,&inode_disk->direct_map_table[i])){
-      allocated++; 
-    }
-    else {
-      if(!extend)
-	inode_free_map_deallocate(inode_disk);
-      return false;
-    } 
-  }
-
-  if(indirect_blocks==0){
-    goto success;
-  }  
-  /* allocate indirect blocks */
-  if(o_indirect_blocks==0){
-    if(!(free_map_allocate(1,&inode_disk->indirect_block_sec))){
-      if(!extend)
-	inode_free_map_deallocate(inode_disk);
-      return false;    
-    }
-  }
-  struct buffer_head* indirect_block_head = buffer_get(inode_disk->indirect_block_sec);
-  block_sector_t* indirect_block = calloc(1,BLOCK_SECTOR_SIZE);
-  buffer_read(indirect_block_head,(void*)indirect_block,0,BLOCK_SECTOR_SIZE);
-  for(i=o_indirect_blocks;i<indirect_blocks;i++){
-    if(free_map_allocate(1,&indirect_block[i])){
-      allocated++; 
-    }
-    else {
-      /* need to write it so it can be traced for deallocation */
-      indirect_block_head = buffer_get(inode_disk->indirect_block_sec);
-      buffer_write(indirect_block_head,(void*)indirect_block,0,BLOCK_SECTOR_SIZE); 
-      if(!extend)
-	inode_free_map_deallocate(inode_disk);
-      free(indirect_block);
-      return false;
-   }
+/* write zeros to the CNT sectors starting at START, which were
+   just allocated, without going through the cache */
+static void zero_sectors(block_sector_t start, size_t cnt){
+  size_t i;
+  for(i = 0; i < cnt; i++){
+    buffer_forget(start+i);
+    block_write(fs_device,start+i,zeros);
   }
-  /* write the allocated indirect block */
-  indirect_block_head = buffer_get(inode_disk->indirect_block_sec);
-  buffer_write(indirect_block_head,(void*)indirect_block,0,BLOCK_SECTOR_SIZE);
-  free(indirect_block);
+}
 
+/* give a zero-filled sector to every block in [*IDX, CNT) of
+   INODE_DISK that has none yet, moving *IDX along.  Each run of
+   such blocks, up to ALLOCATE_RUN long, gets one contiguous range
+   of sectors if the free map has one, or else is split in halves
+   until it fits.  Stops early when the journal operation has no
+   room to install another block.  Returns false if the disk is
+   full. */
+static bool inode_free_map_allocate(size_t* idx, size_t cnt, struct inode_disk* inode_disk){
+  block_sector_t start;
+  size_t run, k;
 
-  if(d_indirect_blocks==0){
-    goto success; 
-  }
-  /* allocate 32 sectors max due to 8MB limit */
-  d_indirect_blocks = d_indirect_blocks > D_INDIRECT_BLOCK_FILE_MAX? D_INDIRECT_BLOCK_FILE_MAX: d_indirect_blocks; 
-  /* allocate doubly indirect block */ 
-  if(o_d_indirect_blocks==0){
-    if(!(free_map_allocate(1,&inode_disk->double_indirect_block_sec))){
-      if(!extend)
-	inode_free_map_deallocate(inode_disk);
-      return false;    
-    } 
-  }
-
-  /* read the allocacted doubly indirect block*/
-  struct buffer_head* d_indirect_block_head = buffer_get(inode_disk->double_indirect_block_sec);
-  block_sector_t* d_indirect_block = calloc(1,BLOCK_SECTOR_SIZE);
-  buffer_read(d_indirect_block_head,(void*)d_indirect_block,0,BLOCK_SECTOR_SIZE);
- 
-  if (o_d_indirect_blocks == D_INDIRECT_BLOCK_FILE_MAX) 
-    d_indirect_blocks = D_INDIRECT_BLOCK_FILE_MAX; 
-
-  /* allocate in the last unfull indirect block */ 
-  if(o_d_indirect_in_last != INDIRECT_BLOCK_ENTRIES){
-    /* read last indirect block */ 
-    struct buffer_head* o_d_indirect_lastblock_head = buffer_get(d_indirect_block[o_d_indirect_blocks-1]);
-    block_sector_t* o_d_indirect_lastblock =calloc(1,BLOCK_SECTOR_SIZE); 
-    buffer_read(o_d_indirect_lastblock_head ,(void*) o_d_indirect_lastblock,0,BLOCK_SECTOR_SIZE); 
-    /* allocate */ 
-    size_t allocate_until = d_indirect_blocks>o_d_indirect_blocks? 128:
-      (d_indirect_in_last > D_INDIRECT_LAST_MAX 
-       && o_d_indirect_blocks==D_INDIRECT_BLOCK_FILE_MAX)?
-      D_INDIRECT_LAST_MAX : d_indirect_in_last; 
-
-    for(i=o_d_indirect_in_last;i<allocate_until;i++){
-     if(!(free_map_allocate(1,&o_d_indirect_lastblock[i]))){
-      o_d_indirect_lastblock_head =buffer_get(d_indirect_block[o_d_indirect_blocks-1]);
-      buffer_write(o_d_indirect_lastblock_head ,(void*) o_d_indirect_lastblock,0,BLOCK_SECTOR_SIZE); 
-      if(!extend)
-	inode_free_map_deallocate(inode_disk);
-      free(o_d_indirect_lastblock);  
-      free(d_indirect_block);
-      return false;    
-     }
-     else 
-       allocated++; 
-    }
-    free(o_d_indirect_lastblock);  
-}
-  size_t blocks_to_allocate = INDIRECT_BLOCK_ENTRIES; 
- /* allocate indirect blocks */
-  for(i=o_d_indirect_blocks;i<d_indirect_blocks;i++){
-    if(!(free_map_allocate(1,&d_indirect_block[i]))){
-      d_indirect_block_head = buffer_get(inode_disk->double_indirect_block_sec);
-      buffer_write(d_indirect_block_head,(void*)d_indirect_block,0,BLOCK_SECTOR_SIZE);
-      if(!extend)
-	inode_free_map_deallocate(inode_disk);
-      free(d_indirect_block);
-      return false;    
-    }  
-    /* read the allocated indirect block*/
-    struct buffer_head* d_second_indirect_block_head = buffer_get(d_indirect_block[i]);
-    block_sector_t* d_second_indirect_block = calloc(1,BLOCK_SECTOR_SIZE);  
-    buffer_read(d_second_indirect_block_head,(void*)d_second_indirect_block,0,BLOCK_SECTOR_SIZE); 
-    if (i==d_indirect_blocks-1)
-      blocks_to_allocate = d_indirect_in_last > D_INDIRECT_LAST_MAX? D_INDIRECT_LAST_MAX:d_indirect_in_last; ;
-    for(j=0;j<blocks_to_allocate;j++){
-      if(!free_map_allocate(1,&d_second_indirect_block[j])){
-	d_second_indirect_block_head = buffer_get(d_indirect_block[i]);
-	buffer_write(d_second_indirect_block_head,(void*)d_second_indirect_block,0,BLOCK_SECTOR_SIZE);
-	if(!extend)
-	  inode_free_map_deallocate(inode_disk);
-	free(d_second_indirect_block);
-	free(d_indirect_block);
-	return false; 
+  while(*idx < cnt){
+    if(block_map_lookup(NULL,inode_disk,*idx) != 0){
+      ++*idx;
+      continue;
+    }
+    if(journal_room() < INSTALL_CREDITS + 2)
+      return true;
+    for(run = 1; run < ALLOCATE_RUN && *idx + run < cnt
+	  && block_map_lookup(NULL,inode_disk,*idx+run) == 0; run++)
+      continue;
+    while(!free_map_allocate_near(run,block_map_goal(inode_disk,*idx),&start)){
+      if(run == 1)
+	return false;
+      run /= 2;
+    }
+    zero_sectors(start,run);
+    for(k = 0; k < run; k++, ++*idx){
+      if(journal_room() < INSTALL_CREDITS){
+	free_map_release(start+k,run-k);
+	return true;
       }
-      else
-	allocated++;
-    }  
-    /* write to buffer*/ 
-    d_second_indirect_block_head = buffer_get(d_indirect_block[i]);
-    buffer_write(d_second_indirect_block_head,(void*)d_second_indirect_block,0,BLOCK_SECTOR_SIZE);
-    free(d_second_indirect_block);
-  }
-  d_indirect_block_head = buffer_get(inode_disk->double_indirect_block_sec);
-  buffer_write(d_indirect_block_head,(void*)d_indirect_block,0,BLOCK_SECTOR_SIZE);
-  free(d_indirect_block);
- success:
-  return true;  
-}
-/* deallocate all sectors used by INODE_DISK */ 
-void inode_free_map_deallocate(struct inode_disk* inode_disk){
-  size_t cnt = bytes_to_sectors(inode_disk->length);  
-  size_t direct = 0;
-  size_t indirect = 0; 
-  size_t d_indirect_blocks=0;
-  size_t d_indirect_in_last=0; 
-  size_t i;
-
-  sectors_divide(cnt, &direct,&indirect,&d_indirect_blocks,&d_indirect_in_last);
-  // direct blocks
-  for(i=0;i<direct;i++){
-    free_map_release(inode_disk->direct_map_table[i],1);
-    inode_disk->direct_map_table[i] = (block_sector_t)(-1);
+      if(!block_map_install(inode_disk,*idx,start+k)){
+	free_map_release(start+k,run-k);
+	return false;
+      }
+    }
   }
-  
-  //indirect blocks
-  if (indirect ==0 ) 
-    return;
-  struct buffer_head* indirect_block_head = buffer_get(inode_disk->indirect_block_sec);
-  block_sector_t* indirect_block=calloc(1,BLOCK_SECTOR_SIZE);
-  buffer_read(indirect_block_head,(void*)indirect_block,0,BLOCK_SECTOR_SIZE);
-  for (i=0;i<indirect;i++){
-    free_map_release(indirect_block[i],1); 
-    indirect_block[i] = (block_sector_t)(-1);
-  }
-  indirect_block_head = buffer_get(inode_disk->indirect_block_sec);
-  buffer_write(indirect_block_head,indirect_block,0,BLOCK_SECTOR_SIZE);
-  free(indirect_block);
-  inode_disk->indirect_block_sec = (block_sector_t)(-1);
-  //double indirect blocks
-  if (d_indirect_blocks==0) 
-    return; 
-  struct buffer_head* d_indirect_block_head = buffer_get(inode_disk->double_indirect_block_sec); 
-  block_sector_t* d_indirect_block = calloc(1,BLOCK_SECTOR_SIZE); 
-  buffer_read(d_indirect_block_head,(void*)d_indirect_block,0,BLOCK_SECTOR_SIZE);
- 
-
-  for(i=0;i<d_indirect_blocks;i++){
-    struct buffer_head* d_second_indirect_block_head = buffer_get(d_indirect_block[i]); 
-    block_sector_t* d_second_indirect_block = calloc(1,BLOCK_SECTOR_SIZE);
-    buffer_read(d_second_indirect_block_head,(void*)d_second_indirect_block,0,BLOCK_SECTOR_SIZE);
-  
-    size_t j;
-    size_t until = INDIRECT_BLOCK_ENTRIES;  
-    if (i==d_indirect_blocks-1)
-      until = d_indirect_in_last; 
-    for(j=0;j<until;j++){
-      free_map_release(d_second_indirect_block[i],1);
-      d_second_indirect_block[i]= (block_sector_t)(-1);
-    }
-    d_second_indirect_block_head = buffer_get(d_indirect_block[i]); 
-    buffer_write(d_second_indirect_block_head,(void*)d_second_indirect_block,0,BLOCK_SECTOR_SIZE);
-    free(d_second_indirect_block);  
-    d_indirect_block[i] = (block_sector_t)(-1);
-  }
-  d_indirect_block_head = buffer_get(inode_disk->double_indirect_block_sec); 
-  buffer_write(d_indirect_block_head,(void*)d_indirect_block,0,BLOCK_SECTOR_SIZE);
-  free(d_indirect_block); 
-  inode_disk->double_indirect_block_sec = (block_sector_t)(-1);
-  
+  return true;
 }
 
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data reads as zeros: past what fits in the inode
+   it is a hole until written, so creating a file of any length
+   adds just its inode to the journal.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails. */
 bool
 inode_create (block_sector_t sector, off_t length,int is_dir)
 {
@@ -438,19 +560,19 @@ inode_create (block_sector_t sector, off_t length,int is_dir)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
- 
-      size_t sectors = bytes_to_sectors (length);
+      disk_inode->self_sector = sector;
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
       disk_inode->is_dir = is_dir;
+      /* small files start out with their data in the inode */
+      if (length <= (off_t) INODE_INLINE_SIZE)
+        disk_inode->flags = INODE_INLINE;
      
-      if (inode_free_map_allocate(sectors,0,disk_inode))
-        {
-          //block_write (fs_device, sector, disk_inode);
-          struct buffer_head* inode_head = buffer_get(sector); 
-	  buffer_write(inode_head,(void*)disk_inode,0,BLOCK_SECTOR_SIZE);
-          success = true; 
-        }
+      journal_begin();
+      struct buffer_head* inode_head = buffer_get_new(sector);
+      buffer_write_meta(inode_head,(void*)disk_inode,0,BLOCK_SECTOR_SIZE);
+      journal_end();
+      success = true;
       free (disk_inode);
     }
 
@@ -459,23 +581,36 @@ inode_create (block_sector_t sector, off_t length,int is_dir)
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
-struct inode *
-inode_open (block_sector_t sector)
+/* Returns the open inode for SECTOR with its open count bumped,
+   or a null pointer if it is not open.  OPEN_INODES_LOCK must be
+   held. */
+static struct inode *
+inode_lookup (block_sector_t sector)
 {
   struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
   for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
        e = list_next (e)) 
     {
       inode = list_entry (e, struct inode, elem);
       if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+        return inode_reopen (inode);
     }
+  return NULL;
+}
+
+struct inode *
+inode_open (block_sector_t sector)
+{
+  struct inode *inode, *open;
+
+  /* Check whether this inode is already open. */
+  rwlock_acquire_read (&open_inodes_lock);
+  inode = inode_lookup (sector);
+  rwlock_release_read (&open_inodes_lock);
+  if (inode != NULL)
+    return inode;
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
@@ -483,7 +618,6 @@ inode_open (block_sector_t sector)
     return NULL;
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
 
@@ -493,11 +627,28 @@ inode_open (block_sector_t sector)
   buffer_read(entry,(void*)inode_disk,0,BLOCK_SECTOR_SIZE);
   inode->length = inode_disk->length;
   inode->is_dir = inode_disk->is_dir;
+  inode->is_inline = (inode_disk->flags & INODE_INLINE) != 0;
   inode->pos = 0;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  inode->meta_dirty = false;
+  inode->map_gen = 0;
+  inode_forget_map(inode);
   free(inode_disk);
-  lock_init(&inode->lock);
+  rwlock_init(&inode->lock);
+  rwlock_init(&inode->dir_lock);
+
+  /* someone else may have opened it while we read it */
+  rwlock_acquire_write (&open_inodes_lock);
+  open = inode_lookup (sector);
+  if (open == NULL)
+    list_push_front (&open_inodes, &inode->elem);
+  rwlock_release_write (&open_inodes_lock);
+  if (open != NULL)
+    {
+      free (inode);
+      return open;
+    }
   return inode;
 }
 
@@ -506,7 +657,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      enum intr_level old_level = intr_disable ();
+      inode->open_cnt++;
+      intr_set_level (old_level);
+    }
   return inode;
 }
 
@@ -523,26 +678,53 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  enum intr_level old_level;
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  /* Release resources if this was the last opener.  Nobody can
+     find INODE once it is off the list. */
+  rwlock_acquire_write (&open_inodes_lock);
+  old_level = intr_disable ();
+  last = --inode->open_cnt == 0;
+  intr_set_level (old_level);
+  if (last)
+    list_remove (&inode->elem);
+  rwlock_release_write (&open_inodes_lock);
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         { 
-	  struct buffer_head* inode_disk_head = buffer_get(inode->sector);
-	  struct inode_disk* inode_disk = calloc(1,sizeof(struct inode_disk));
-	  buffer_read(inode_disk_head,(void*)inode_disk,0,BLOCK_SECTOR_SIZE);
+	  int i;
+	  inode_forget_map(inode);
+	  /* data that never got a sector is simply dropped */
+	  for(i=0;i<64;i++)
+	    if(buffer_heads[i].in_use && buffer_heads[i].delalloc==inode)
+	      buffer_drop_delalloc(&buffer_heads[i]);
 
-	  inode_free_map_deallocate(inode_disk);
-	  free_map_release(inode->sector,1);
-	  free(inode_disk);
+	  /* the blocks themselves are freed in the background */
+	  struct reclaim* r = malloc(sizeof *r);
+	  if(r == NULL)
+	    inode_reclaim(inode->sector);
+	  else{
+	    r->sector = inode->sector;
+	    lock_acquire(&reclaim_lock);
+	    list_push_back(&reclaim_list,&r->elem);
+	    lock_release(&reclaim_lock);
+	    work_queue(&reclaim_work);
+	  }
+        }
+      else
+        {
+          journal_begin ();
+          rwlock_acquire_write (&inode->lock);
+          inode_flush_delalloc_all (inode);
+          rwlock_release_write (&inode->lock);
+          journal_end ();
         }
 
       free (inode); 
@@ -558,22 +740,140 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* return the buffer holding block IDX of INODE.  INODE_DISK is the
+   caller's copy of the on-disk inode, read at block map generation
+   *MAP_GEN; it is read again if the map has changed since, and
+   not at all while the extent cache has the answer.  A block
+   without a sector is served from its delayed allocation buffer.
+   If it has none either, a write gets a new one, or for metadata a
+   sector right away; a read gets NULL. */
+static struct buffer_head* inode_get_block(struct inode* inode, struct inode_disk* inode_disk, unsigned* map_gen, size_t idx, bool write){
+  block_sector_t sector;
+  struct buffer_head* entry;
+
+  if((sector = extent_lookup(inode,idx)) != 0)
+    return buffer_get(sector);
+  if(*map_gen != inode->map_gen)
+    *map_gen = inode_load_disk(inode,inode_disk);
+  sector = block_map_lookup(inode,inode_disk,idx);
+  if(sector != 0){
+    extent_insert(inode,idx,sector);
+    return buffer_get(sector);
+  }
+  if((entry = buffer_find_delalloc(inode,idx)) != NULL)
+    return entry;
+  /* the block may have got its sector while we looked */
+  if(*map_gen != inode->map_gen)
+    return inode_get_block(inode,inode_disk,map_gen,idx,write);
+  if(!write)
+    return NULL;
+
+  if(!inode_is_metadata(inode))
+    return buffer_new_delalloc(inode,idx);
+  /* metadata blocks are journaled by sector, allocate one now */
+  if(!free_map_allocate_near(1,block_map_goal(inode_disk,idx),&sector))
+    return NULL;
+  if(!block_map_install(inode_disk,idx,sector)){
+    free_map_release(sector,1);
+    return NULL;
+  }
+  *map_gen = ++inode->map_gen;
+  inode->meta_dirty = true;
+  extent_insert(inode,idx,sector);
+  return buffer_get_new(sector);
+}
+
+/* set INODE's length to NEW_LENGTH bytes.  No block is allocated
+   or freed: when a file grows, the blocks between the old end of
+   file and the write stay holes, which read as zeros until
+   something is written to them, and the blocks the write covers
+   are left to inode_get_block(). */
+static void inode_set_length(struct inode* inode, off_t new_length){
+  struct buffer_head* inode_head = buffer_get(inode->sector);
+  buffer_write_meta(inode_head,(void*)&new_length,
+		    offsetof(struct inode_disk,length),sizeof new_length);
+  inode->length = new_length;
+  inode->meta_dirty = true;
+}
+
+/* move the data of INODE out of its inode sector into data blocks,
+   so that the block map can take its place.  Runs inside INODE's
+   lock and journal operation.  If the blocks cannot all be had, the
+   ones that were are given back and INODE is left inline as it
+   was, and false is returned. */
+static bool inode_unline(struct inode* inode){
+  off_t length = inode_length(inode);
+  uint16_t flags = 0;
+  struct inode_disk* inode_disk;
+  uint8_t* data;
+  bool success;
+  int i;
+
+  if((data = malloc(INODE_INLINE_SIZE)) == NULL)
+    return false;
+  if((inode_disk = malloc(sizeof *inode_disk)) == NULL){
+    free(data);
+    return false;
+  }
+  buffer_read(buffer_get(inode->sector),data,INLINE_OFS,length);
+  buffer_write_meta(buffer_get(inode->sector),zeros,INLINE_OFS,INODE_INLINE_SIZE);
+  buffer_write_meta(buffer_get(inode->sector),&flags,
+		    offsetof(struct inode_disk,flags),sizeof flags);
+  inode->is_inline = false;
+  inode_forget_map(inode);
+  inode->map_gen++;
+  inode->meta_dirty = true;
+  success = inode_do_write_at(inode,data,length,0) == length;
+  if(!success){
+    /* give back whatever the write got, then put the data back */
+    for(i = 0; i < 64; i++)
+      if(buffer_heads[i].in_use && buffer_heads[i].delalloc == inode)
+	buffer_drop_delalloc(&buffer_heads[i]);
+    inode_load_disk(inode,inode_disk);
+    inode_disk_trim(inode_disk,0);
+    flags = INODE_INLINE;
+    buffer_write_meta(buffer_get(inode->sector),data,INLINE_OFS,length);
+    buffer_write_meta(buffer_get(inode->sector),&flags,
+		      offsetof(struct inode_disk,flags),sizeof flags);
+    inode_set_length(inode,length);
+    inode->is_inline = true;
+    inode_forget_map(inode);
+    inode->map_gen++;
+  }
+  free(inode_disk);
+  free(data);
+  return success;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+static off_t
+inode_do_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
+  struct inode_disk* inode_disk = malloc(sizeof *inode_disk);
+  unsigned map_gen;
+
+  if(inode_disk == NULL)
+    return 0;
+  if(inode->is_inline){
+    if(size > inode_length(inode) - offset)
+      size = inode_length(inode) - offset;
+    if(size > 0){
+      buffer_read(buffer_get(inode->sector),buffer,INLINE_OFS+offset,size);
+      bytes_read = size;
+    }
+    free(inode_disk);
+    return bytes_read;
+  }
+  /* read INODE_DISK on the first extent cache miss */
+  map_gen = inode->map_gen - 1;
   while (size > 0) 
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      if(sector_idx == (block_sector_t)(-1)){
-	return 0 ;
-	//sector_idx = byte_to_sector (inode,inode_length(inode)-1);
-      }
+      /* Block to read, starting byte offset within sector. */
+      size_t block_idx = offset / BLOCK_SECTOR_SIZE;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -586,154 +886,481 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      /* Try to read from buffer cache f*/ 
-      struct buffer_head* entry = get_buffer_head(sector_idx); 
-      if(entry==NULL){/* cache miss */ 
-	/* find a empty entry from buffer heads */
-	if(list_size(&buffer_cache)<64){
-	  if((entry = find_empty_buffer())==NULL)
-	    return -1;
-	}
-	/* select a victim entry */ 
-	else{
-	  if((entry=buffer_select_victim())==NULL)
-	    return -1; 
-	  if (entry->dirty==true)
-	    buffer_flush_to_disk(entry);
-	  buffer_release(entry); 
-	}
-	/* read a block into buffer cache */ 
-	entry->data = malloc(BLOCK_SECTOR_SIZE);
-	block_read (fs_device, sector_idx, entry->data);
-	entry->in_use = true; 
-	entry->on_disk_sector = sector_idx; 	
-	list_push_back(&buffer_cache,&entry->elem);
+      struct buffer_head* entry = inode_get_block(inode,inode_disk,&map_gen,block_idx,false);
+      if(entry != NULL){
+	entry->owner = inode->sector;
+	buffer_read(entry, buffer+bytes_read, sector_ofs,chunk_size);
       }
-      
-      /* at this point, SECTOR_IDX must have been allocated */
-      entry = buffer_get(sector_idx);
-      buffer_read(entry, buffer+bytes_read, sector_ofs,chunk_size); 
+      else /* a hole, no need to touch the disk */
+	memset(buffer+bytes_read,0,chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-
+  free(inode_disk);
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
-off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+   less than SIZE if the disk is full, MAX_FILE_SIZE is reached
+   or an error occurs.  A write past end of file extends the
+   inode, leaving a hole if it starts past the old end.  Blocks
+   of regular files get their sectors only when they are written
+   back (see inode_flush_delalloc()). */
+static off_t
+inode_do_write_at (struct inode *inode, const void *buffer_, off_t size,
+                   off_t offset) 
 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  off_t old_offset = offset;
-  off_t old_size = size;
-  off_t length = inode_length(inode);
-  bool extend = false;
-  int extended = 0;
-  struct inode_disk* inode_disk = calloc(1,sizeof(struct inode_disk));
-  if (inode->deny_write_cnt)
+  struct inode_disk* inode_disk;
+  unsigned map_gen;
+  if (inode->deny_write_cnt || offset >= MAX_FILE_SIZE)
     return 0;
+  if (size > MAX_FILE_SIZE - offset)
+    size = MAX_FILE_SIZE - offset;
+  if ((inode_disk = malloc(sizeof *inode_disk)) == NULL)
+    return 0;
+  if (inode->is_inline)
+    {
+      if (offset + size <= (off_t) INODE_INLINE_SIZE)
+        {
+          if (offset + size > inode_length (inode))
+            inode_set_length (inode, offset + size);
+          buffer_write_meta (buffer_get (inode->sector), (void *) buffer,
+                             INLINE_OFS + offset, size);
+          /* the data is metadata now, synced with the journal */
+          inode->meta_dirty = true;
+          free (inode_disk);
+          return size;
+        }
+      if (!inode_unline (inode))
+        size = 0;
+    }
   
+  /* read INODE_DISK on the first extent cache miss */
+  map_gen = inode->map_gen - 1;
+  if (offset + size > inode_length (inode))
+    inode_set_length(inode,offset+size);
   while (size > 0) 
     {
-      if(length == 0){
-	extend = true;
-      }
-      /* update the inode if the file was extended */ 
-      if (extend){  
-	/* allocate new sectors */ 
-	size_t new_cnt = bytes_to_sectors(old_size+old_offset);
-	size_t old_cnt = bytes_to_sectors(length);
-	struct buffer_head* inode_disk_head = buffer_get(inode->sector);
-	//struct inode_disk* inode_disk = calloc(1,sizeof(inode_disk));
-	buffer_read(inode_disk_head,(void*)inode_disk,0,BLOCK_SECTOR_SIZE);
-	inode_free_map_allocate(new_cnt,old_cnt,inode_disk);
-	inode_disk->length = old_size+old_offset;
-	inode_disk_head = buffer_get(inode->sector);
-	buffer_write(inode_disk_head,(void*)inode_disk,0,BLOCK_SECTOR_SIZE);
-	length =  inode_length(inode);
-	extend = false;
-	extended = 1;
-	/* write data */ 
-      }
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      if(sector_idx == (block_sector_t)(-1))
-	sector_idx = byte_to_sector (inode, length-1);
+      /* Block to write, starting byte offset within sector. */
+      size_t block_idx = offset / BLOCK_SECTOR_SIZE;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
-      if(inode_left==0)
-	extend=true;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
       /* Number of bytes to actually write into this sector. */
       int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0 && extend == false)
+      if (chunk_size <= 0)
         break;
-      /* try to write to buffer cache */ 
-      struct buffer_head* entry = get_buffer_head(sector_idx);
-      if(entry==NULL){/* cache miss */
-	if(list_size(&buffer_cache)<64){
-	  if ((entry = find_empty_buffer())==NULL){ 
-	    bytes_written = -1;
-	    goto done;
-	  }
-	}
-	/* select a victim entry */ 
-	else{
-	  if((entry = buffer_select_victim())==NULL){
-	    bytes_written = -1;
-	    goto done;
-	  }
-	  if(entry->dirty == true)
-	    buffer_flush_to_disk(entry); 
-	  buffer_release(entry); 
-	}
-	/* read from on disk block to cache */ 
-	entry->data = malloc(BLOCK_SECTOR_SIZE);
-	block_read(fs_device, sector_idx, entry->data); 
-	entry->in_use = true; 
-	entry->on_disk_sector = sector_idx;
-	list_push_back(&buffer_cache,&entry->elem);
-      }
       
-      entry = buffer_get(sector_idx);
+      struct buffer_head* entry = inode_get_block(inode,inode_disk,&map_gen,block_idx,true);
+      if(entry == NULL)
+	break;
+      entry->owner = inode->sector;
       buffer_write(entry,(void*)(buffer+bytes_written), sector_ofs,chunk_size);
+      if(inode_is_metadata(inode))
+	journal_add(entry);
      
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
-      /* check for need of file extension */ 
-      if(bytes_written+old_offset>length && extended!=1){
-	extend = true; 
-      }
     }
- done:
   free(inode_disk);
   return bytes_written;
 }
 
+/* Allocates the blocks of INODE from OFFSET up to END that have
+   no sector yet, as far as one journal operation has room for, in
+   as few contiguous runs as the free map allows, and grows INODE
+   to the offset reached if it is shorter.  Data already in the
+   range is left alone and the new blocks read as zeros, so later
+   writes to the range never need the allocator.  Returns the
+   offset reached, or -1 if INODE may not be written or the disk
+   is full. */
+static off_t
+inode_do_allocate (struct inode *inode, off_t offset, off_t end)
+{
+  struct inode_disk *inode_disk;
+  size_t idx = offset / BLOCK_SECTOR_SIZE;
+  off_t reached;
+
+  if (inode->deny_write_cnt || inode->is_dir)
+    return -1;
+  if ((inode_disk = malloc (sizeof *inode_disk)) == NULL)
+    return -1;
+
+  if (inode->is_inline && end <= (off_t) INODE_INLINE_SIZE)
+    {
+      /* the space is already there, in the inode */
+      if (end > inode_length (inode))
+        inode_set_length (inode, end);
+      free (inode_disk);
+      return end;
+    }
+  if (inode->is_inline && !inode_unline (inode))
+    {
+      free (inode_disk);
+      return -1;
+    }
+  /* pending data keeps the sectors delayed allocation gives it */
+  if (!inode_flush_delalloc (inode))
+    {
+      free (inode_disk);
+      return offset;
+    }
+  inode_load_disk (inode, inode_disk);
+  if (!inode_free_map_allocate (&idx, bytes_to_sectors (end), inode_disk))
+    reached = -1;
+  else if ((off_t) idx * BLOCK_SECTOR_SIZE >= end)
+    reached = end;
+  else
+    reached = (off_t) idx * BLOCK_SECTOR_SIZE > offset
+              ? (off_t) idx * BLOCK_SECTOR_SIZE : offset;
+  inode->map_gen++;
+  inode->meta_dirty = true;
+  if (reached > inode_length (inode))
+    inode_set_length (inode, reached);
+  free (inode_disk);
+  return reached;
+}
+
+/* Sets INODE's length to LENGTH bytes.  Growing leaves a hole.
+   Shrinking frees the blocks past the new end, last first, and the
+   pointer blocks left empty, and zeros the rest of the new last
+   block so that growing the file again reads zeros there.  If the
+   journal operation has no room to free them all, clears *DONE and
+   leaves the length alone, to be called again in a new operation.
+   Returns false if INODE may not be written. */
+static bool
+inode_do_truncate (struct inode *inode, off_t length, bool *done)
+{
+  struct inode_disk *inode_disk;
+  size_t keep = bytes_to_sectors (length);
+  int i;
+
+  *done = true;
+  if (inode->deny_write_cnt || inode->is_dir || length < 0
+      || length > MAX_FILE_SIZE)
+    return false;
+  if ((inode_disk = malloc (sizeof *inode_disk)) == NULL)
+    return false;
+
+  if (inode->is_inline && length > (off_t) INODE_INLINE_SIZE
+      && !inode_unline (inode))
+    {
+      free (inode_disk);
+      return false;
+    }
+  if (inode->is_inline)
+    {
+      /* keep the bytes past the end zero */
+      if (length < inode_length (inode))
+        buffer_write_meta (buffer_get (inode->sector), zeros,
+                           INLINE_OFS + length, inode_length (inode) - length);
+    }
+  else if (length < inode_length (inode))
+    {
+      /* data past the new end that never got a sector is dropped */
+      for (i = 0; i < 64; i++)
+        if (buffer_heads[i].in_use && buffer_heads[i].delalloc == inode
+            && buffer_heads[i].delalloc_idx >= keep)
+          buffer_drop_delalloc (&buffer_heads[i]);
+
+      if (length % BLOCK_SECTOR_SIZE != 0)
+        {
+          unsigned map_gen = inode->map_gen - 1;
+          struct buffer_head *entry
+            = inode_get_block (inode, inode_disk, &map_gen,
+                               length / BLOCK_SECTOR_SIZE, false);
+          if (entry != NULL)
+            buffer_write (entry, zeros, length % BLOCK_SECTOR_SIZE,
+                          BLOCK_SECTOR_SIZE - length % BLOCK_SECTOR_SIZE);
+        }
+
+      inode_load_disk (inode, inode_disk);
+      *done = inode_disk_trim (inode_disk, keep);
+      inode_forget_map (inode);
+      inode->map_gen++;
+    }
+  if (*done)
+    inode_set_length (inode, length);
+  free (inode_disk);
+  return true;
+}
+
+/* Acquires INODE's lock for writing, which serializes the changes
+   to its data and block map with inode_defrag() and keeps readers
+   out, unless the running thread already holds it.  Returns true if
+   it was acquired here.  A change that is journaled starts its
+   journal operation first, since journal_begin() may wait for the
+   operations in progress, and one of them may need this lock. */
+static bool
+inode_lock (struct inode *inode)
+{
+  if (rwlock_write_held_by_current_thread (&inode->lock))
+    return false;
+  rwlock_acquire_write (&inode->lock);
+  return true;
+}
+
+/* Releases INODE's lock if inode_lock() returned LOCKED. */
+static void
+inode_unlock (struct inode *inode, bool locked)
+{
+  if (locked)
+    rwlock_release_write (&inode->lock);
+}
+
+/* Readers hold INODE's lock for reading, so they run alongside
+   each other but never see a change half done. */
+off_t
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) 
+{
+  off_t bytes_read;
+
+  if (rwlock_held_by_current_thread (&inode->lock))
+    return inode_do_read_at (inode, buffer, size, offset);
+  rwlock_acquire_read (&inode->lock);
+  bytes_read = inode_do_read_at (inode, buffer, size, offset);
+  rwlock_release_read (&inode->lock);
+  return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE at OFFSET as one
+   journal operation. */
+static off_t
+inode_write_once (struct inode *inode, const uint8_t *buffer, off_t size,
+                  off_t offset)
+{
+  off_t bytes_written;
+  bool locked;
+
+  journal_begin ();
+  locked = inode_lock (inode);
+  bytes_written = inode_do_write_at (inode, buffer, size, offset);
+  inode_unlock (inode, locked);
+  journal_end ();
+  return bytes_written;
+}
+
+/* A write that finds DELALLOC_MAX buffers waiting for delayed
+   allocation waits until they have their sectors and goes on.  One
+   that runs out of space is tried once more after the space that
+   removed files and uncommitted transactions hold has come back. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+                off_t offset) 
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+  bool waited = false;
+
+  while (bytes_written < size)
+    {
+      bytes_written += inode_write_once (inode, buffer + bytes_written,
+                                         size - bytes_written,
+                                         offset + bytes_written);
+      if (bytes_written == size)
+        break;
+      if (buffer_delalloc_full () && !journal_in_handle ())
+        buffer_flush_delalloc ();
+      else if (!waited && inode_wait_space ())
+        waited = true;
+      else
+        break;
+    }
+  return bytes_written;
+}
+
+/* Allocates from OFFSET towards END of INODE in one journal
+   operation.  Returns the offset reached, or -1 on failure. */
+static off_t
+inode_allocate_once (struct inode *inode, off_t offset, off_t end)
+{
+  off_t reached;
+  bool locked;
+
+  journal_begin ();
+  locked = inode_lock (inode);
+  reached = inode_do_allocate (inode, offset, end);
+  inode_unlock (inode, locked);
+  journal_end ();
+  return reached;
+}
+
+/* The range is allocated in as many journal operations as it
+   takes, so that allocating a large range does not overflow a
+   transaction.  A crash may leave the file grown only part of the
+   way. */
+bool
+inode_allocate (struct inode *inode, off_t offset, off_t length)
+{
+  off_t end = offset + length;
+  off_t reached;
+
+  if (offset < 0 || length <= 0 || offset > MAX_FILE_SIZE - length)
+    return false;
+  while (offset < end)
+    {
+      reached = inode_allocate_once (inode, offset, end);
+      if (reached < 0 && inode_wait_space ())
+        reached = inode_allocate_once (inode, offset, end);
+      if (reached < 0)
+        return false;
+      offset = reached;
+    }
+  return true;
+}
+
+/* The blocks are freed in as many journal operations as it takes.
+   A crash may leave the file at its old length, with its last
+   blocks already freed, reading as zeros. */
+bool
+inode_truncate (struct inode *inode, off_t length)
+{
+  bool locked, success, done;
+
+  do
+    {
+      journal_begin ();
+      locked = inode_lock (inode);
+      success = inode_do_truncate (inode, length, &done);
+      inode_unlock (inode, locked);
+      journal_end ();
+    }
+  while (success && !done);
+  return success;
+}
+
+/* Moves the data blocks of INODE into one run of consecutive
+   sectors near the inode.  Holes stay holes.
+
+   The run is set aside first.  Then, as many blocks per journal
+   operation as it has room for, each block is copied to its new
+   sector, which nothing points to yet, the block map is switched
+   over to it and the old sector is freed, so a crash leaves each
+   block at one location or the other.  The file may stay open
+   meanwhile; readers and writers wait on INODE's lock while a part
+   is moved and run in between, and blocks it gains meanwhile stay
+   where they are.  Must not be called inside a journal operation.
+   Returns false if no free run is large enough. */
+bool
+inode_defrag (struct inode *inode)
+{
+  struct inode_disk *inode_disk;
+  block_sector_t start, prev, old;
+  size_t blocks, cnt, i, k;
+  bool in_order;
+  char *data;
+
+  if (inode->sector == FREE_MAP_SECTOR)
+    return false;
+  inode_disk = malloc (sizeof *inode_disk);
+  data = malloc (BLOCK_SECTOR_SIZE);
+  if (inode_disk == NULL || data == NULL)
+    {
+      free (inode_disk);
+      free (data);
+      return false;
+    }
+  journal_begin ();
+  rwlock_acquire_write (&inode->lock);
+  if (inode->is_inline)
+    {
+      /* nothing to move */
+      rwlock_release_write (&inode->lock);
+      journal_end ();
+      free (inode_disk);
+      free (data);
+      return true;
+    }
+
+  /* give pending data its sectors, then count the mapped blocks */
+  inode_flush_delalloc_all (inode);
+  inode_load_disk (inode, inode_disk);
+  blocks = bytes_to_sectors (inode_length (inode));
+  cnt = 0;
+  prev = 0;
+  in_order = true;
+  for (i = 0; i < blocks; i++)
+    if ((old = block_map_lookup (NULL, inode_disk, i)) != 0)
+      {
+        if (cnt > 0 && old != prev + 1)
+          in_order = false;
+        prev = old;
+        cnt++;
+      }
+  if (in_order
+      || !free_map_claim (cnt, inode_disk->self_sector + 1, &start))
+    {
+      rwlock_release_write (&inode->lock);
+      journal_end ();
+      free (inode_disk);
+      free (data);
+      return in_order;
+    }
+
+  /* move the blocks in order, copying through the cache, which has
+     the latest data.  A block takes its new sector's and its old
+     sector's free map sectors, besides installing it. */
+  for (i = k = 0; i < blocks && k < cnt; i++)
+    {
+      if (journal_room () < INSTALL_CREDITS + 2)
+        {
+          /* nothing may keep using the old sectors */
+          inode_forget_map (inode);
+          inode->map_gen++;
+          inode->meta_dirty = true;
+          rwlock_release_write (&inode->lock);
+          journal_end ();
+          journal_begin ();
+          rwlock_acquire_write (&inode->lock);
+          inode_load_disk (inode, inode_disk);
+          blocks = bytes_to_sectors (inode_length (inode));
+          if (i >= blocks)
+            break;
+        }
+      if ((old = block_map_lookup (NULL, inode_disk, i)) == 0)
+        continue;
+      buffer_read (buffer_get (old), data, 0, BLOCK_SECTOR_SIZE);
+      buffer_forget (start + k);
+      block_write (fs_device, start + k, data);
+      free_map_take (start + k, 1);
+      block_map_install (inode_disk, i, start + k++);
+      free_map_release (old, 1);
+    }
+  if (k < cnt)
+    free_map_unclaim (start + k, cnt - k);
+  inode_forget_map (inode);
+  inode->map_gen++;
+  inode->meta_dirty = true;
+
+  rwlock_release_write (&inode->lock);
+  journal_end ();
+  free (inode_disk);
+  free (data);
+  return true;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  bool locked = inode_lock (inode);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  inode_unlock (inode, locked);
 }
 
 /* Re-enables writes to INODE.
@@ -742,36 +1369,268 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  bool locked = inode_lock (inode);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  inode_unlock (inode, locked);
+}
+
+/* Writes INODE's dirty data buffers back to disk, leaving them
+   cached.  Unless DATA_ONLY, and in any case if INODE's length or
+   block map changed since the last sync, also commits the journal
+   so that the metadata needed to find the data is durable. */
+void
+inode_sync (struct inode *inode, bool data_only)
+{
+  bool commit, locked;
+  int i;
+
+  journal_begin ();
+  locked = inode_lock (inode);
+  if (locked)
+    inode_flush_delalloc_all (inode);
+  else
+    inode_flush_delalloc (inode);
+  for (i = 0; i < 64; i++)
+    {
+      struct buffer_head *b = &buffer_heads[i];
+      if (b->in_use && b->dirty && !b->journaled
+          && (b->owner == inode->sector || b->on_disk_sector == inode->sector))
+        buffer_writeback (b, inode->sector);
+    }
+  commit = !data_only || inode->meta_dirty || inode_is_metadata (inode);
+  if (commit)
+    inode->meta_dirty = false;
+  inode_unlock (inode, locked);
+  journal_end ();
+  if (commit)
+    journal_sync ();
 }
 
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
 {
-  off_t length = 0;
-  struct buffer_head* inode_disk_head = buffer_get(inode->sector);
-  struct inode_disk* inode_disk = calloc(1,sizeof(struct inode_disk));
-  buffer_read(inode_disk_head, (void*)inode_disk,0,BLOCK_SECTOR_SIZE);
-  length = inode_disk->length;
-  return length;
+  return inode->length;
+}
+
+/* Delayed allocation */
+
+/* the pointer block that maps block IDX, as a number that blocks
+   under the same pointer block share; the direct blocks share the
+   inode */
+static size_t block_map_leaf(size_t idx){
+  return idx < DIRECT_BLOCK_ENTRIES ? (size_t) -1
+    : (idx - DIRECT_BLOCK_ENTRIES) / INDIRECT_BLOCK_ENTRIES;
+}
+
+/* give the delayed allocation buffers of INODE their sectors, as
+   many as the journal operation has room for.  The blocks are
+   sorted by position in the file and allocated as one contiguous
+   run if the free map has one, so a file written in small appends
+   still ends up in consecutive sectors.  Each block is written to
+   its sector before the journal operation ends, so the transaction
+   that maps it cannot commit first (ordered mode).  Returns true
+   if no buffer of INODE is left waiting.  INODE's lock and a
+   journal operation must be held. */
+static bool inode_flush_delalloc(struct inode* inode){
+  struct buffer_head* pending[64];
+  struct inode_disk* inode_disk;
+  block_sector_t start, sector;
+  bool contiguous;
+  size_t cnt = 0, n, cost, room;
+  size_t i, j;
+
+  ASSERT(rwlock_write_held_by_current_thread(&inode->lock));
+  ASSERT(journal_in_handle());
+  lock_acquire(&cache_lock);
+  for(i = 0; i < 64; i++){
+    struct buffer_head* b = &buffer_heads[i];
+    if(!b->in_use || b->delalloc != inode || b->pinned)
+      continue;
+    /* keep it in the cache until it has been written */
+    b->pinned = true;
+    for(j = cnt; j > 0 && pending[j-1]->delalloc_idx > b->delalloc_idx; j--)
+      pending[j] = pending[j-1];
+    pending[j] = b;
+    cnt++;
+  }
+  lock_release(&cache_lock);
+  if(cnt == 0)
+    return true;
+  if((inode_disk = malloc(sizeof *inode_disk)) == NULL)
+    PANIC("out of memory allocating file blocks");
+
+  /* the run takes as many blocks as the operation surely has room
+     to install: the two free map sectors of the run, and a block
+     under the same pointer block as the one before adds nothing */
+  room = journal_room();
+  for(n = 0, cost = 2; n < cnt; n++){
+    if(n == 0 || block_map_leaf(pending[n]->delalloc_idx)
+       != block_map_leaf(pending[n-1]->delalloc_idx))
+      cost += INSTALL_CREDITS;
+    if(cost > room)
+      break;
+  }
+  inode_load_disk(inode,inode_disk);
+  contiguous = n > 0 && free_map_allocate_reserved(n,block_map_goal(inode_disk,pending[0]->delalloc_idx),&start);
+  for(i = 0; i < cnt; i++){
+    if(contiguous && i < n)
+      sector = start + i;
+    else if(contiguous || journal_room() < INSTALL_CREDITS + 1)
+      break;
+    else if(!free_map_allocate_reserved(1,block_map_goal(inode_disk,pending[i]->delalloc_idx),&sector))
+      PANIC("file system full writing back reserved blocks");
+    buffer_forget(sector);
+    if(!block_map_install(inode_disk,pending[i]->delalloc_idx,sector))
+      PANIC("file system full writing back reserved blocks");
+    extent_insert(inode,pending[i]->delalloc_idx,sector);
+    lock_acquire(&cache_lock);
+    pending[i]->on_disk_sector = sector;
+    pending[i]->delalloc = NULL;
+    lock_release(&cache_lock);
+    rwlock_acquire_read(&pending[i]->evict_lock);
+    block_write(fs_device,sector,pending[i]->data);
+    pending[i]->dirty = false;
+    rwlock_release_read(&pending[i]->evict_lock);
+    /* it counts against DELALLOC_MAX until it may be evicted */
+    lock_acquire(&cache_lock);
+    pending[i]->pinned = false;
+    delalloc_cnt--;
+    lock_release(&cache_lock);
+  }
+  /* the rest wait for the next operation, their sectors still
+     reserved */
+  for(j = i; j < cnt; j++)
+    pending[j]->pinned = false;
+  if(i > 0){
+    inode->map_gen++;
+    inode->meta_dirty = true;
+  }
+  free(inode_disk);
+  return i == cnt;
+}
+
+/* give every delayed allocation buffer of INODE its sector, in as
+   many journal operations as it takes.  The caller must have taken
+   INODE's lock and started the journal operation itself, since they
+   are given up and taken again in between. */
+static void inode_flush_delalloc_all(struct inode* inode){
+  while(!inode_flush_delalloc(inode)){
+    rwlock_release_write(&inode->lock);
+    journal_end();
+    journal_begin();
+    rwlock_acquire_write(&inode->lock);
+  }
+}
+
+/* give every delayed allocation buffer in the cache its sector.
+   Each inode is held open and locked while its buffers are, so the
+   caller must hold no inode's lock and be outside any journal
+   operation. */
+static void buffer_flush_delalloc(void){
+  struct inode* inode;
+  int i;
+
+  ASSERT(!journal_in_handle());
+  for(i = 0; i < 64; i++){
+    inode = NULL;
+    rwlock_acquire_read(&open_inodes_lock);
+    lock_acquire(&cache_lock);
+    /* an inode being closed for the last time flushes its own */
+    if(buffer_heads[i].in_use && buffer_heads[i].delalloc != NULL
+       && buffer_heads[i].delalloc->open_cnt > 0)
+      inode = inode_reopen(buffer_heads[i].delalloc);
+    lock_release(&cache_lock);
+    rwlock_release_read(&open_inodes_lock);
+    if(inode == NULL)
+      continue;
+
+    journal_begin();
+    rwlock_acquire_write(&inode->lock);
+    inode_flush_delalloc_all(inode);
+    rwlock_release_write(&inode->lock);
+    journal_end();
+    inode_close(inode);
+  }
+}
+
+/* true if DELALLOC_MAX buffers wait for delayed allocation, so that
+   new writes must wait for them to get their sectors */
+static bool buffer_delalloc_full(void){
+  return delalloc_cnt >= DELALLOC_MAX;
+}
+
+/* the delayed allocation buffer holding block IDX of INODE, NULL if
+   there is none */
+static struct buffer_head* buffer_find_delalloc(struct inode* inode, size_t idx){
+  struct buffer_head* entry = NULL;
+  int i;
+
+  lock_acquire(&cache_lock);
+  for(i = 0; i < 64; i++){
+    struct buffer_head* b = &buffer_heads[i];
+    if(b->in_use && b->delalloc == inode && b->delalloc_idx == idx){
+      entry = b;
+      break;
+    }
+  }
+  lock_release(&cache_lock);
+  return entry;
+}
+
+/* a zeroed buffer for block IDX of INODE, which has no sector yet.
+   A sector is reserved for it so that the write back cannot fail
+   for lack of space.  Returns NULL if the disk is full or
+   DELALLOC_MAX buffers are waiting already; the writer holds locks
+   that flushing them may need, so it is up to inode_write_at() to
+   wait for them. */
+static struct buffer_head* buffer_new_delalloc(struct inode* inode, size_t idx){
+  struct buffer_head* entry;
+
+  if(!free_map_reserve(1))
+    return NULL;
+  lock_acquire(&cache_lock);
+  if(buffer_delalloc_full()){
+    lock_release(&cache_lock);
+    free_map_unreserve(1);
+    return NULL;
+  }
+  entry = buffer_alloc();
+  memset(entry->data,0,BLOCK_SECTOR_SIZE);
+  entry->in_use = true;
+  entry->access = true;
+  entry->on_disk_sector = BUFFER_DELALLOC;
+  entry->delalloc = inode;
+  entry->delalloc_idx = idx;
+  entry->owner = inode->sector;
+  delalloc_cnt++;
+  list_push_back(&buffer_cache,&entry->elem);
+  lock_release(&cache_lock);
+  return entry;
+}
+
+/* throw away delayed allocation buffer ENTRY, whose data is no
+   longer part of its file */
+static void buffer_drop_delalloc(struct buffer_head* entry){
+  lock_acquire(&cache_lock);
+  buffer_release(entry);
+  delalloc_cnt--;
+  lock_release(&cache_lock);
+  free_map_unreserve(1);
 }
 
 /* Buffer cache */
 
 /* return the buffer_head corresponding ot SECTOR, NULL if no such
-   entry is found */
+   entry is found.  CACHE_LOCK must be held. */
 struct buffer_head* get_buffer_head(block_sector_t sector){
   int i;
+  ASSERT(lock_held_by_current_thread(&cache_lock));
   for (i =0; i<64; i++){
-    if (buffer_heads[i].on_disk_sector == sector){
-      if (buffer_heads[i].in_use==false)
-	return NULL; 
-      buffer_heads[i].in_use = true; /* buffer is in use */
+    if (buffer_heads[i].in_use && buffer_heads[i].on_disk_sector == sector)
       return &buffer_heads[i];
-    }
   }
   return NULL;
 }
@@ -787,121 +1646,263 @@ struct buffer_head* find_empty_buffer(void){
   }
   return NULL; 
 }
+/* clock algorithm: the first sweep clears access bits, the second
+   finds a victim.  Pinned buffers, buffers in the running journal
+   transaction, which leave only once it commits, and buffers still
+   waiting for a sector, which only their inode's lock holder may
+   give one, are passed over.  CACHE_LOCK must be held. */
 struct buffer_head* buffer_select_victim(void){
 
+  ASSERT(lock_held_by_current_thread(&cache_lock));
   ASSERT(list_size(&buffer_cache)==64);
-  if(cache_hand == NULL)/*first eviction*/ 
-    cache_hand = list_begin(&buffer_cache);
-  struct list_elem* e; 
   struct buffer_head* entry;  
-  for (e=cache_hand;e!=list_end(&buffer_cache);e=list_next(e)){
-    entry = list_entry(e,struct buffer_head, elem); 
-    if(entry->access == true){
+  int i;
+  for (i = 0; i < 2*64; i++){
+    if(cache_hand == NULL || cache_hand == list_end(&buffer_cache))
+      cache_hand = list_begin(&buffer_cache);
+    entry = list_entry(cache_hand,struct buffer_head, elem);
+    cache_hand = list_next(cache_hand);
+    if(entry->pinned || entry->journaled || entry->delalloc != NULL)
+      continue;
+    if(entry->access == true)
       entry->access = false; 
-      cache_hand = (cache_hand==list_end(&buffer_cache)->prev)? 
-	list_begin(&buffer_cache):list_next(cache_hand); 
-    }
-    else{  
+    else
       return entry; 
-    }
   }
-  /* if all buffers are accessed recently, evict the first page which
-     is in_use for the longest */
-  entry = list_entry(list_begin(&buffer_cache),struct buffer_head, elem); 
-  return entry; 
+  return NULL;
 }
+/* evict ENTRY: once nobody is reading or writing it, write it
+   back if it is dirty and take it out of the cache.  CACHE_LOCK
+   must be held. */
 void buffer_flush_to_disk(struct buffer_head* entry){
 
+  ASSERT(lock_held_by_current_thread(&cache_lock));
   ASSERT(entry->in_use == true);
-
-  lock_acquire(&entry->evict_lock);
-  entry->evicting = true;
-  if(entry->accessing){
-    cond_wait(&entry->accessed,&entry->evict_lock);
+  ASSERT(entry->delalloc == NULL);
+  /* write-ahead: metadata reaches the log before its home sector */
+  ASSERT(!entry->journaled);
+  rwlock_acquire_write(&entry->evict_lock);
+  if(entry->dirty)
+    block_write(fs_device,entry->on_disk_sector,entry->data); 
+  buffer_release(entry);
+  rwlock_release_write(&entry->evict_lock);
+}
+/* write ENTRY back to disk if it still belongs to OWNER and is
+   dirty, keeping it in the cache */
+static void buffer_writeback(struct buffer_head* entry, block_sector_t owner){
+  rwlock_acquire_read(&entry->evict_lock);
+  if(entry->in_use && entry->dirty && !entry->journaled
+     && entry->delalloc == NULL
+     && (owner == BUFFER_NO_OWNER || entry->owner == owner
+	 || entry->on_disk_sector == owner)){
+    block_write(fs_device,entry->on_disk_sector,entry->data);
+    entry->dirty = false;
   }
-  block_write(fs_device,entry->on_disk_sector,entry->data); 
-  entry->in_use = false; 
-  entry->evicting = false;
-  cond_signal(&entry->evicted,&entry->evict_lock);
-  lock_release(&entry->evict_lock);
+  rwlock_release_read(&entry->evict_lock);
 }
 void buffer_release(struct buffer_head* entry){
   /* reset victim entry from buffer head */
   ASSERT(entry!=NULL);
+  ASSERT(lock_held_by_current_thread(&cache_lock));
   entry->in_use = false; 
   entry->dirty = false; 
   entry->access = false; 
-  entry->evicting = false; 
-  entry->accessing = false;
+  entry->journaled = false;
+  entry->owner = BUFFER_NO_OWNER;
+  entry->delalloc = NULL;
+  entry->pinned = false;
   memset(entry->data, 0, BLOCK_SECTOR_SIZE); 
+  if(cache_hand == &entry->elem)
+    cache_hand = list_next(cache_hand);
   list_remove(&entry->elem);
 } 
 
-void buffer_flush_all(void){
-  struct list_elem* e; 
-  struct buffer_head* entry; 
-  for (e = list_begin(&buffer_cache);e!=list_end(&buffer_cache);e=list_next(e)){
-    entry = list_entry(e,struct buffer_head, elem); 
-    if (entry->dirty==true)
-      buffer_flush_to_disk(entry);
+/* drop the cached copy of SECTOR, which was just allocated, without
+   writing it: whatever it held belonged to a freed block.  The
+   free map hands out no sector before the transaction that freed
+   it has committed, so the copy is not in the running one. */
+static void buffer_forget(block_sector_t sector){
+  struct buffer_head* entry;
+
+  lock_acquire(&cache_lock);
+  if((entry = get_buffer_head(sector)) != NULL){
+    ASSERT(!entry->journaled);
     buffer_release(entry);
+  }
+  lock_release(&cache_lock);
+}
+
+/* take a free buffer, evicting one if the cache is full.  The
+   buffer is not in the cache list yet.  There is always one to
+   evict, since the journal and delayed allocation hold fewer
+   buffers than the cache has, unless -journal-crash stopped the
+   journal, which keeps every buffer it would have logged.
+   CACHE_LOCK must be held. */
+static struct buffer_head* buffer_alloc(void){
+  struct buffer_head* entry; 
+  ASSERT(lock_held_by_current_thread(&cache_lock));
+  if(list_size(&buffer_cache)<64){/* cache not full, find an empty buffer */
+    entry = find_empty_buffer();
+    ASSERT(entry != NULL);
+  }
+  else{/* cache full, evict a entry */
+    /* find victim */
+    if((entry = buffer_select_victim())==NULL)
+      PANIC("buffer cache full of metadata the stopped journal holds");
+    buffer_flush_to_disk(entry);
   }  
+  return entry;
+}
+
+/* write every dirty buffer back to disk, keeping it cached */
+void buffer_flush_all(void){
+  int i;
+  buffer_flush_delalloc();
+  /* ordered mode: the data goes out before the transaction that
+     maps it commits */
+  for (i = 0; i < 64; i++)
+    buffer_writeback(&buffer_heads[i],BUFFER_NO_OWNER);
+  journal_sync();
 }
 /* given a sector index, get the buffer_head associated if it is there, or bring it from disk to buffer first otherwise, return the buffer_head */
 struct buffer_head* buffer_get(block_sector_t sector){
-  struct buffer_head* entry = get_buffer_head(sector); 
-  if (entry==NULL){/*cache miss*/
-    if(list_size(&buffer_cache)<64){/* cache not full, find an empty buffer */
-      if ((entry=find_empty_buffer())==NULL)
-	return NULL; 
-    }
-    else{/* cache full, evict a entry */
-      /* find victim */
-      if((entry = buffer_select_victim())==NULL)
-	return NULL;
-      /* flush the buffer to disk if it is dirty */
-      if(entry->dirty == true) 
-	buffer_flush_to_disk(entry);
-      buffer_release(entry);
-    }
-    entry->data = malloc(BLOCK_SECTOR_SIZE); 
-    block_read(fs_device, sector, entry->data); 
-    entry->in_use = true; 
-    entry->on_disk_sector = sector; 
-    list_push_back(&buffer_cache,&entry->elem); 
-  }
-  /* /\* read from buffer *\/  */
-  //lock_acquire(&entry->evict_lock);
+  struct buffer_head* entry;
+
+  lock_acquire(&cache_lock);
+  entry = get_buffer_head(sector); 
+  if (entry!=NULL){
+    entry->access = true;
+    lock_release(&cache_lock);
+    return entry;
+  }
+  /*cache miss*/
+  entry = buffer_alloc();
+  entry->in_use = true; 
+  entry->access = true;
+  entry->on_disk_sector = sector; 
+  list_push_back(&buffer_cache,&entry->elem); 
+  /* the buffer is in the cache before the sector is, so anyone
+     else missing on SECTOR finds it and waits on EVICT_LOCK until
+     it is read in */
+  rwlock_acquire_write(&entry->evict_lock);
+  lock_release(&cache_lock);
+  block_read(fs_device, sector, entry->data); 
+  rwlock_release_write(&entry->evict_lock);
   return entry; 
-  
+}
+/* get a zeroed, dirty buffer for SECTOR, which was just allocated,
+   without reading the sector from disk */
+static struct buffer_head* buffer_get_new(block_sector_t sector){
+  struct buffer_head* entry;
+  buffer_forget(sector);
+  lock_acquire(&cache_lock);
+  entry = buffer_alloc();
+  memset(entry->data,0,BLOCK_SECTOR_SIZE);
+  entry->in_use = true;
+  entry->dirty = true;
+  entry->access = true;
+  entry->on_disk_sector = sector;
+  list_push_back(&buffer_cache,&entry->elem);
+  lock_release(&cache_lock);
+  return entry;
 }
 void buffer_write(struct buffer_head* buffer_head, void* buffer, off_t ofs, int chunk_size){
-  if(!lock_held_by_current_thread(&buffer_head->evict_lock))
-     lock_acquire(&buffer_head->evict_lock); 
-  buffer_head->accessing = true;
-  if(buffer_head->evicting){
-    cond_wait(&buffer_head->evicted,&buffer_head->evict_lock);
-  }
+  rwlock_acquire_write(&buffer_head->evict_lock);
   buffer_direct_write(buffer_head,buffer,ofs,chunk_size);
-  buffer_head->accessing = false;
-  cond_signal(&buffer_head->accessed,&buffer_head->evict_lock);
-  lock_release(&buffer_head->evict_lock);
+  rwlock_release_write(&buffer_head->evict_lock);
 }
+/* any number of threads may read a buffer at once */
 void buffer_read(struct buffer_head* buffer_head, void* buffer, off_t ofs, int chunk_size){
-  if(!lock_held_by_current_thread(&buffer_head->evict_lock))
-    lock_acquire(&buffer_head->evict_lock); 
-  if(buffer_head->evicting){
-    cond_wait(&buffer_head->evicted,&buffer_head->evict_lock);
-  }
+  rwlock_acquire_read(&buffer_head->evict_lock);
   buffer_direct_read(buffer_head,buffer,ofs,chunk_size);
-  cond_signal(&buffer_head->accessed,&buffer_head->evict_lock);
-  lock_release(&buffer_head->evict_lock);
+  rwlock_release_read(&buffer_head->evict_lock);
 }
 void write_behind(void* aux UNUSED){
-  
-  while(1){
-    timer_sleep(WRITE_BEHIND_ALARM);
-    buffer_flush_all();
+  /* group commit: the data, then everything logged since the last
+     run */
+  buffer_flush_all();
+  work_queue_delayed(&write_behind_work,WRITE_BEHIND_ALARM);
+}
+
+/* free the blocks of the removed inode at SECTOR, then SECTOR
+   itself, as many blocks per journal operation as it has room for
+   and starting from the end of the file, so that other file system
+   operations get to run in between */
+static void inode_reclaim(block_sector_t sector){
+  struct inode_disk* inode_disk = calloc(1,sizeof(struct inode_disk));
+  bool done;
+
+  if(inode_disk == NULL)
+    PANIC("out of memory freeing a file");
+  buffer_read(buffer_get(sector),(void*)inode_disk,0,BLOCK_SECTOR_SIZE);
+  /* an inline file has no blocks of its own */
+  if(!(inode_disk->flags & INODE_INLINE))
+    do{
+      journal_begin();
+      done = inode_disk_trim(inode_disk,0);
+      journal_end();
+    }while(!done);
+  journal_begin();
+  free_map_release(sector,1);
+  journal_end();
+  free(inode_disk);
+}
+
+/* frees the blocks of removed inodes handed over by inode_close() */
+/* frees the blocks of the inodes on RECLAIM_LIST until it is
+   empty.  Runs as work, and may run on two workers at once if an
+   inode was queued while it was running. */
+static void reclaim_run(void* aux UNUSED){
+  struct reclaim* r;
+
+  lock_acquire(&reclaim_lock);
+  while(!list_empty(&reclaim_list)){
+    r = list_entry(list_pop_front(&reclaim_list),struct reclaim,elem);
+    reclaiming++;
+    lock_release(&reclaim_lock);
+
+    inode_reclaim(r->sector);
+    free(r);
+
+    lock_acquire(&reclaim_lock);
+    reclaiming--;
   }
+  if(reclaiming == 0)
+    cond_broadcast(&reclaim_idle,&reclaim_lock);
+  lock_release(&reclaim_lock);
+}
+
+/* wait until every removed inode has been reclaimed.  Returns
+   false if there was nothing to wait for. */
+static bool inode_reclaim_wait(void){
+  bool busy;
 
+  lock_acquire(&reclaim_lock);
+  busy = reclaiming > 0 || !list_empty(&reclaim_list);
+  while(reclaiming > 0 || !list_empty(&reclaim_list))
+    cond_wait(&reclaim_idle,&reclaim_lock);
+  lock_release(&reclaim_lock);
+  return busy;
+}
+
+/* finish freeing the blocks of removed inodes */
+void inode_reclaim_sync(void){
+  inode_reclaim_wait();
+}
+
+/* wait for the space that removed files, and sectors freed by a
+   transaction that has not committed, still hold.  Not inside a
+   journal operation, which keeps the transaction from committing.
+   Returns true if there was any to wait for. */
+static bool inode_wait_space(void){
+  bool busy;
+
+  if(journal_in_handle())
+    return false;
+  busy = inode_reclaim_wait();
+  if(free_map_held()){
+    journal_sync();
+    busy = true;
+  }
+  return busy;
 }
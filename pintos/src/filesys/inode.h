@@ -7,14 +7,31 @@
 #include "threads/synch.h"
 #include <list.h>
 
-/* on_disk inodes keep 124 direct block entries, one indirect and one
-   doubly indirect block entries */
-#define DIRECT_BLOCK_ENTRIES 122 
+/* on_disk inodes keep 121 direct block entries and one indirect,
+   one doubly indirect and one triply indirect block entry */
+#define DIRECT_BLOCK_ENTRIES 121
 #define INDIRECT_BLOCK_ENTRIES 128
 #define D_INDIRECT_BLOCK_ENTRIES 128*128
-#define D_INDIRECT_BLOCK_FILE_MAX 127
-#define D_INDIRECT_LAST_MAX 6
-#define MAX_FILE_SIZE 8*1024*1024
+#define T_INDIRECT_BLOCK_ENTRIES 128*128*128
+/* levels of pointer blocks under the deepest block map entry */
+#define BLOCK_MAP_LEVELS 3
+/* largest file the block map can describe, a little over 1 GB */
+#define MAX_FILE_SIZE ((off_t) (DIRECT_BLOCK_ENTRIES + INDIRECT_BLOCK_ENTRIES \
+				+ D_INDIRECT_BLOCK_ENTRIES            \
+				+ T_INDIRECT_BLOCK_ENTRIES)           \
+		       * BLOCK_SECTOR_SIZE)
+
+/* owner of a buffer that holds no file data */
+#define BUFFER_NO_OWNER ((block_sector_t)(-1))
+/* sector of a buffer whose data has no sector yet */
+#define BUFFER_DELALLOC ((block_sector_t)(-2))
+
+/* bytes of data a file can keep in its inode, in place of the
+   block map */
+#define INODE_INLINE_SIZE ((DIRECT_BLOCK_ENTRIES + BLOCK_MAP_LEVELS) \
+			   * sizeof (block_sector_t))
+/* inode_disk flags */
+#define INODE_INLINE 0x1		/* data is in INLINE_DATA */
 
 struct bitmap;
 struct inode_disk
@@ -22,11 +39,31 @@ struct inode_disk
   block_sector_t self_sector;
   unsigned magic;                     /* Magic number. */ 
   off_t length;                       /* File size in bytes. */
-  int is_dir; 
-  block_sector_t direct_map_table[DIRECT_BLOCK_ENTRIES];
-  block_sector_t indirect_block_sec; 
-  block_sector_t double_indirect_block_sec;
+  uint16_t is_dir; 
+  uint16_t flags;                     /* INODE_* flags. */
+  union
+    {
+      struct
+	{
+	  block_sector_t direct_map_table[DIRECT_BLOCK_ENTRIES];
+	  block_sector_t indirect_block_sec; 
+	  block_sector_t double_indirect_block_sec;
+	  block_sector_t triple_indirect_block_sec;
+	};
+      uint8_t inline_data[INODE_INLINE_SIZE];
+    };
 };
+/* a run of consecutive blocks of a file stored in consecutive
+   sectors */
+struct block_extent
+  {
+    size_t idx;				/* first block of the run */
+    block_sector_t sector;		/* sector of block IDX */
+    size_t len;				/* blocks in the run, 0 if unused */
+  };
+/* extents cached per open inode */
+#define INODE_EXTENTS 8
+
 /* In-memory inode. */
 struct inode 
   {
@@ -36,10 +73,30 @@ struct inode
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     //struct inode_disk data;             /* Inode content. */
-    struct lock lock; 
+    struct rwlock lock;			/* held for writing by writers and
+					   inode_defrag(), for reading by
+					   readers */
     off_t length; 
     int is_dir;
     off_t pos; 		/* only used for directories */
+    struct rwlock dir_lock;		/* directories: held for writing
+					   while entries are added or
+					   removed, for reading while
+					   they are looked up */
+    bool is_inline;		/* data lives in the inode sector */
+    bool meta_dirty;		/* length or block map changed since
+				   the last inode_sync() */
+    unsigned map_gen;		/* bumped whenever the block map
+				   changes */
+    /* the cached mappings below are shared by the readers of the
+       inode and only change with interrupts off */
+    size_t leaf_base;		/* blocks LEAF_BASE and on are mapped */
+    block_sector_t leaf_sector;	/* by pointer block LEAF_SECTOR, the
+				   last one a lookup went through, 0
+				   if none */
+    struct block_extent extents[INODE_EXTENTS]; /* resolved block map,
+						   most recently used
+						   first */
   };
 /* buffer cache */
 struct buffer_head
@@ -52,23 +109,30 @@ struct buffer_head
   void* data; 				/* virtual address of the
 					   associated buffer cache
 					   entry */
-  /* when a buffer is being read or written, or when it is being evicted, EVICT_LOCK is acquired. Because these two actions are mutually exclusive: a buffer being read should not be evicted, and a buffer being evicted should not be read or written.  */
-  struct lock evict_lock; 	  	 
-  struct condition evicted; 
-  bool evicting; 
-  
-  struct condition accessed;  		/* make sure buffer in the
-					   process of reading or
-					   writing will not be
-					   evicted */ 
-  bool accessing;
+  /* a buffer being read or written must not be evicted, and a
+     buffer being evicted must not be read or written.  Readers hold
+     EVICT_LOCK for reading; writers and eviction hold it for
+     writing. */
+  struct rwlock evict_lock;
 
   struct lock extend_lock;		/* file extending should be atomic */ 
   struct condition extended;
+
+  block_sector_t owner;			/* inode sector of the file whose
+					   data this buffer holds, or
+					   BUFFER_NO_OWNER */
+  bool journaled;			/* holds metadata in the running
+					   journal transaction, must not
+					   be written in place before it
+					   commits */
+  struct inode* delalloc;		/* file whose block DELALLOC_IDX
+					   this buffer holds until it gets
+					   a sector, or NULL */
+  size_t delalloc_idx;
+  bool pinned;				/* must not be evicted */
 };
 void inode_init (void);
 bool inode_create (block_sector_t, off_t,int);
-bool inode_free_map_allocate(size_t cnt,size_t old, struct inode_disk* inode_disk);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
@@ -76,9 +140,14 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+bool inode_allocate (struct inode *, off_t offset, off_t length);
+bool inode_truncate (struct inode *, off_t length);
+bool inode_defrag (struct inode *);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+void inode_sync (struct inode *, bool data_only);
+void inode_reclaim_sync (void);
 
 
 void cache_init(void);
@@ -0,0 +1,377 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead log for file system metadata.
+
+   Inode sectors, indirect blocks, directory data and the free
+   map are "metadata".  Every buffer holding metadata that is
+   modified joins the running transaction and stays pinned in
+   the buffer cache until the transaction commits.  Operations
+   that must be atomic bracket their updates with
+   journal_begin() and journal_end(); a transaction commits only
+   when no operation is in progress, so many operations are
+   grouped into one transaction and reach the disk with a single
+   sequential log write.
+
+   Each operation reserves JOURNAL_HANDLE_CREDITS log sectors when
+   it starts and may add no more sectors than that to the running
+   transaction.  Once the running transaction and the reservations
+   of the operations in progress would pass JOURNAL_TX_CREDITS, new
+   operations wait until the ones in progress finish and the
+   transaction commits.  Because journal_begin() may wait like
+   this, it must be called before taking any file system lock: an
+   operation in progress may need that lock to finish.
+
+   Committing writes a descriptor block listing the sectors, a
+   copy of each sector and finally a commit block to the log
+   region, then checkpoints the sectors to their home locations
+   and records the transaction as checkpointed in the journal
+   super block.  If the machine stops before the commit block is
+   written, the transaction never happened; if it stops after,
+   journal_open() replays the log at the next boot. */
+
+/* Identify the journal's on-disk structures. */
+#define JOURNAL_SUPER_MAGIC 0x4a524e4c
+#define JOURNAL_DESC_MAGIC 0x4a444553
+#define JOURNAL_COMMIT_MAGIC 0x4a434d54
+
+/* Journal super block, stored at JOURNAL_SECTOR. */
+struct journal_super
+  {
+    unsigned magic;                     /* JOURNAL_SUPER_MAGIC. */
+    block_sector_t log_start;           /* First sector of the log. */
+    block_sector_t log_size;            /* Number of sectors in the log. */
+    unsigned seq;                       /* Last checkpointed transaction. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 16];
+  };
+
+/* Descriptor block, the first sector of a logged transaction. */
+struct journal_desc
+  {
+    unsigned magic;                     /* JOURNAL_DESC_MAGIC. */
+    unsigned seq;                       /* Transaction sequence number. */
+    unsigned cnt;                       /* Number of logged sectors. */
+    block_sector_t sectors[JOURNAL_MAX_BLOCKS]; /* Their home sectors. */
+  };
+
+/* Commit block, written after the logged sectors. */
+struct journal_commit
+  {
+    unsigned magic;                     /* JOURNAL_COMMIT_MAGIC. */
+    unsigned seq;                       /* Must match the descriptor. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8];
+  };
+
+static struct journal_super super;      /* In-memory super block. */
+static bool journal_enabled;            /* False on unjournaled disks. */
+
+static struct lock journal_lock;        /* Protects everything below. */
+static struct condition journal_idle;   /* Signaled after each commit. */
+static int handles;                     /* Operations in progress. */
+static bool commit_wanted;              /* Someone waits for a commit. */
+static unsigned commit_cnt;             /* Number of do_commit() calls. */
+static bool crash_pending;              /* Next commit stops, see below. */
+static bool stopped;                    /* Crashed on purpose. */
+static struct buffer_head *tx[JOURNAL_MAX_BLOCKS]; /* Running transaction. */
+static size_t tx_cnt;                   /* Number of buffers in TX. */
+
+/* -journal-crash: Stop at the commit the first journal_sync()
+   asks for, after its commit block is written but before it is
+   checkpointed, and keep every later change in memory, as if the
+   machine had crashed there, so that the next boot must replay
+   the log.  For testing journal_open(). */
+bool journal_crash;
+
+static void do_commit (void);
+
+/* Allocates the log region and writes an empty journal to the
+   file system device.  Called while formatting. */
+void
+journal_create (void)
+{
+  struct journal_desc *desc;
+
+  memset (&super, 0, sizeof super);
+  super.magic = JOURNAL_SUPER_MAGIC;
+  super.log_size = JOURNAL_LOG_SECTORS;
+  super.seq = 0;
+  if (!free_map_allocate (JOURNAL_LOG_SECTORS, &super.log_start))
+    PANIC ("journal creation failed");
+  block_write (fs_device, JOURNAL_SECTOR, &super);
+
+  desc = calloc (1, BLOCK_SECTOR_SIZE);
+  if (desc == NULL)
+    PANIC ("journal creation failed");
+  block_write (fs_device, super.log_start, desc);
+  free (desc);
+}
+
+/* Reads the journal super block and replays the last logged
+   transaction if it committed but was not checkpointed.  Must be
+   called before anything reads metadata through the buffer
+   cache. */
+void
+journal_open (void)
+{
+  struct journal_desc *desc;
+  struct journal_commit *commit;
+  void *block;
+  unsigned i;
+
+  lock_init (&journal_lock);
+  cond_init (&journal_idle);
+  handles = 0;
+  commit_wanted = false;
+  commit_cnt = 0;
+  stopped = false;
+  tx_cnt = 0;
+
+  block_read (fs_device, JOURNAL_SECTOR, &super);
+  if (super.magic != JOURNAL_SUPER_MAGIC)
+    {
+      printf ("journal: none found, metadata updates are not logged\n");
+      journal_enabled = false;
+      return;
+    }
+  journal_enabled = true;
+
+  desc = malloc (BLOCK_SECTOR_SIZE);
+  commit = malloc (BLOCK_SECTOR_SIZE);
+  block = malloc (BLOCK_SECTOR_SIZE);
+  if (desc == NULL || commit == NULL || block == NULL)
+    PANIC ("can't open journal");
+
+  block_read (fs_device, super.log_start, desc);
+  if (desc->magic == JOURNAL_DESC_MAGIC && desc->seq > super.seq
+      && desc->cnt <= JOURNAL_MAX_BLOCKS)
+    {
+      block_read (fs_device, super.log_start + 1 + desc->cnt, commit);
+      if (commit->magic == JOURNAL_COMMIT_MAGIC && commit->seq == desc->seq)
+        {
+          for (i = 0; i < desc->cnt; i++)
+            {
+              block_read (fs_device, super.log_start + 1 + i, block);
+              block_write (fs_device, desc->sectors[i], block);
+            }
+          printf ("journal: replayed %u sectors of transaction %u\n",
+                  desc->cnt, desc->seq);
+        }
+      super.seq = desc->seq;
+      block_write (fs_device, JOURNAL_SECTOR, &super);
+    }
+
+  free (block);
+  free (commit);
+  free (desc);
+}
+
+/* Starts an operation whose metadata updates must reach the disk
+   atomically.  Operations may nest; only the outermost one
+   reserves log credits, which the nested ones share, and it may
+   wait for a commit first, so the caller must not hold any file
+   system lock. */
+void
+journal_begin (void)
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->journal_depth++ > 0)
+    return;
+  cur->journal_blocks = 0;
+  if (!journal_enabled)
+    return;
+  lock_acquire (&journal_lock);
+  while (!stopped
+         && (commit_wanted
+             || tx_cnt + (handles + 1) * JOURNAL_HANDLE_CREDITS
+                > JOURNAL_TX_CREDITS))
+    {
+      if (handles == 0)
+        do_commit ();
+      else
+        {
+          commit_wanted = true;
+          cond_wait (&journal_idle, &journal_lock);
+        }
+    }
+  handles++;
+  lock_release (&journal_lock);
+}
+
+/* Ends an operation started with journal_begin().  If this was
+   the last operation in progress and another is waiting for
+   room, commits the running transaction. */
+void
+journal_end (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (cur->journal_depth > 0);
+  if (--cur->journal_depth > 0 || !journal_enabled)
+    return;
+  lock_acquire (&journal_lock);
+  ASSERT (handles > 0);
+  if (--handles == 0 && commit_wanted)
+    do_commit ();
+  lock_release (&journal_lock);
+}
+
+/* Returns true if the running thread is inside an operation
+   started with journal_begin(). */
+bool
+journal_in_handle (void)
+{
+  return thread_current ()->journal_depth > 0;
+}
+
+/* Returns how many more sectors the running thread's operation
+   may add to the running transaction.  An operation that goes on
+   for as long as there is room checks this before each step, with
+   the most sectors one step can add. */
+size_t
+journal_room (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (journal_in_handle ());
+  return JOURNAL_HANDLE_CREDITS - cur->journal_blocks;
+}
+
+/* Returns the sequence number of the running transaction, or 0 if
+   metadata updates are not logged.  The transaction has committed
+   once this returns a larger number. */
+unsigned
+journal_running (void)
+{
+  return journal_enabled ? super.seq + 1 : 0;
+}
+
+/* Adds buffer B, which holds metadata that was just modified, to
+   the running transaction.  B stays out of the home location on
+   disk until the transaction commits.  Must be called inside an
+   operation, which keeps the transaction from committing until
+   the operation is done, and counts against its credits unless
+   B is in the transaction already. */
+void
+journal_add (struct buffer_head *b)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (b != NULL);
+  ASSERT (journal_in_handle ());
+  if (!journal_enabled)
+    return;
+  lock_acquire (&journal_lock);
+  if (!b->journaled)
+    {
+      b->journaled = true;
+      cur->journal_blocks++;
+      ASSERT (cur->journal_blocks <= JOURNAL_HANDLE_CREDITS);
+      if (!stopped)
+        {
+          if (tx_cnt == JOURNAL_MAX_BLOCKS)
+            PANIC ("journal transaction too large");
+          tx[tx_cnt++] = b;
+        }
+    }
+  lock_release (&journal_lock);
+}
+
+/* Waits until no operation is in progress and commits the running
+   transaction.  Operations that start meanwhile wait for the
+   commit.  Must not be called inside an operation. */
+void
+journal_sync (void)
+{
+  unsigned cnt;
+
+  if (!journal_enabled)
+    return;
+  ASSERT (!journal_in_handle ());
+  lock_acquire (&journal_lock);
+  cnt = commit_cnt;
+  commit_wanted = true;
+  crash_pending = journal_crash;
+  while (commit_cnt == cnt && !stopped)
+    {
+      if (handles == 0)
+        do_commit ();
+      else
+        cond_wait (&journal_idle, &journal_lock);
+    }
+  lock_release (&journal_lock);
+}
+
+/* Writes the running transaction to the log, checkpoints it and
+   starts a new, empty transaction.  JOURNAL_LOCK must be held. */
+static void
+do_commit (void)
+{
+  struct journal_desc *desc;
+  struct journal_commit *commit;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  ASSERT (handles == 0);
+  commit_cnt++;
+  commit_wanted = false;
+  cond_broadcast (&journal_idle, &journal_lock);
+  if (tx_cnt == 0 || stopped)
+    return;
+
+  desc = calloc (1, sizeof *desc);
+  commit = calloc (1, sizeof *commit);
+  if (desc == NULL || commit == NULL)
+    PANIC ("out of memory committing journal");
+
+  desc->magic = JOURNAL_DESC_MAGIC;
+  desc->seq = super.seq + 1;
+  desc->cnt = tx_cnt;
+  for (i = 0; i < tx_cnt; i++)
+    desc->sectors[i] = tx[i]->on_disk_sector;
+  commit->magic = JOURNAL_COMMIT_MAGIC;
+  commit->seq = desc->seq;
+
+  /* The copy that is checkpointed is exactly the copy that was
+     logged: buffers change only inside an operation, none is open,
+     and buffers in the transaction are never evicted. */
+
+  /* One sequential write: descriptor, sectors, commit block. */
+  block_write (fs_device, super.log_start, desc);
+  for (i = 0; i < tx_cnt; i++)
+    block_write (fs_device, super.log_start + 1 + i, tx[i]->data);
+  block_write (fs_device, super.log_start + 1 + tx_cnt, commit);
+
+  if (crash_pending)
+    {
+      /* Crash here: the logged buffers stay journaled, so nothing
+         writes them home, and nothing is logged from now on. */
+      stopped = true;
+      tx_cnt = 0;
+      free (commit);
+      free (desc);
+      return;
+    }
+
+  /* Checkpoint to the home locations. */
+  for (i = 0; i < tx_cnt; i++)
+    {
+      block_write (fs_device, tx[i]->on_disk_sector, tx[i]->data);
+      tx[i]->dirty = false;
+      tx[i]->journaled = false;
+    }
+  super.seq = desc->seq;
+  block_write (fs_device, JOURNAL_SECTOR, &super);
+  tx_cnt = 0;
+
+  free (commit);
+  free (desc);
+}
@@ -0,0 +1,42 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+struct buffer_head;
+
+/* Number of sectors in the on-disk log: one descriptor block,
+   up to JOURNAL_MAX_BLOCKS logged sectors and a commit block. */
+#define JOURNAL_MAX_BLOCKS 125
+#define JOURNAL_LOG_SECTORS (JOURNAL_MAX_BLOCKS + 2)
+
+/* Log sectors each operation may add to the running transaction.
+   Directory operations stay within this: creating a file touches
+   the free map and the new inode, and adding its entry the
+   directory's inode, at most two directory blocks with the free map
+   sectors they come from, and the pointer blocks between.  Longer
+   operations check journal_room() as they go and continue in a new
+   operation when it runs low. */
+#define JOURNAL_HANDLE_CREDITS 16
+
+/* Sectors the running transaction and the operations in progress
+   may claim before new operations wait for a commit.  Buffers in
+   the transaction cannot be evicted, so together with the buffers
+   waiting for delayed allocation this stays under the size of the
+   buffer cache. */
+#define JOURNAL_TX_CREDITS 32
+
+void journal_create (void);
+void journal_open (void);
+void journal_begin (void);
+void journal_end (void);
+void journal_add (struct buffer_head *);
+void journal_sync (void);
+bool journal_in_handle (void);
+size_t journal_room (void);
+unsigned journal_running (void);
+
+extern bool journal_crash;
+
+#endif /* filesys/journal.h */
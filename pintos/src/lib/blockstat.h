@@ -0,0 +1,43 @@
+#ifndef __LIB_BLOCKSTAT_H
+#define __LIB_BLOCKSTAT_H
+
+#include <stdint.h>
+
+/* I/O accounting for one block device, as returned by the
+   blockstat() system call.  Shared between the kernel and user
+   programs.
+
+   Latencies are measured with the CPU time-stamp counter, in
+   cycles, from the moment a request is submitted to the block
+   layer until the driver completes it, so they include time
+   spent waiting for the device behind other requests. */
+
+/* Number of log2 latency histogram buckets.  Bucket I counts
+   requests that took [2**I, 2**(I+1)) cycles; the last bucket
+   also counts everything slower. */
+#define BLOCKSTAT_BUCKETS 40
+
+/* Roles that blockstat() accepts, in the same order as the
+   kernel's enum block_type. */
+#define BLOCKSTAT_KERNEL 0
+#define BLOCKSTAT_FILESYS 1
+#define BLOCKSTAT_SCRATCH 2
+#define BLOCKSTAT_SWAP 3
+
+struct blockstat
+  {
+    uint64_t read_cnt;                  /* Sectors read. */
+    uint64_t write_cnt;                 /* Sectors written. */
+    uint64_t read_bytes;                /* Bytes read. */
+    uint64_t write_bytes;               /* Bytes written. */
+    uint64_t read_cycles;               /* Total read latency. */
+    uint64_t write_cycles;              /* Total write latency. */
+    uint64_t depth_sum;                 /* Sum of queue depths seen by
+                                           each request at submit. */
+    uint32_t in_flight;                 /* Requests submitted, not done. */
+    uint32_t max_in_flight;             /* Highest IN_FLIGHT seen. */
+    uint32_t read_hist[BLOCKSTAT_BUCKETS];      /* Read latencies. */
+    uint32_t write_hist[BLOCKSTAT_BUCKETS];     /* Write latencies. */
+  };
+
+#endif /* lib/blockstat.h */
@@ -0,0 +1,193 @@
+/* Pairing heap.
+
+   See heap.h for basic information.
+
+   The heap is a tree in which no element is less than any of its
+   children.  Each element links to its first child, and the
+   children of an element form a doubly linked list through `next'
+   and `prev', except that the `prev' of a first child points to
+   its parent.  The root has no siblings. */
+
+#include "heap.h"
+#include "../debug.h"
+
+static bool before (const struct heap *,
+                    const struct heap_elem *, const struct heap_elem *);
+static struct heap_elem *meld (const struct heap *,
+                               struct heap_elem *, struct heap_elem *);
+static struct heap_elem *merge_pairs (const struct heap *,
+                                      struct heap_elem *);
+
+/* Initializes H as an empty heap that compares elements using
+   LESS, given auxiliary data AUX. */
+void
+heap_init (struct heap *h, heap_less_func *less, void *aux) 
+{
+  ASSERT (h != NULL);
+  ASSERT (less != NULL);
+
+  h->root = NULL;
+  h->elem_cnt = 0;
+  h->next_seq = 0;
+  h->less = less;
+  h->aux = aux;
+}
+
+/* Inserts E into H. */
+void
+heap_push (struct heap *h, struct heap_elem *e) 
+{
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+
+  e->child = e->next = e->prev = NULL;
+  e->seq = h->next_seq++;
+  h->root = h->root != NULL ? meld (h, h->root, e) : e;
+  h->elem_cnt++;
+}
+
+/* Returns the greatest element in H, or, among elements that are
+   equally great, the one inserted first.  Returns NULL if H is
+   empty. */
+struct heap_elem *
+heap_top (const struct heap *h) 
+{
+  ASSERT (h != NULL);
+
+  return h->root;
+}
+
+/* Removes and returns the element heap_top() would return, or
+   returns NULL if H is empty. */
+struct heap_elem *
+heap_pop (struct heap *h) 
+{
+  struct heap_elem *top;
+
+  ASSERT (h != NULL);
+
+  top = h->root;
+  if (top != NULL)
+    heap_remove (h, top);
+  return top;
+}
+
+/* Removes E, which must be in H, from H. */
+void
+heap_remove (struct heap *h, struct heap_elem *e) 
+{
+  struct heap_elem *sub;
+
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+  ASSERT (h->elem_cnt > 0);
+
+  sub = merge_pairs (h, e->child);
+  if (e == h->root)
+    h->root = sub;
+  else 
+    {
+      /* Cut E, with its subtree, out of its parent's children. */
+      ASSERT (e->prev != NULL);
+      if (e->prev->child == e)
+        e->prev->child = e->next;
+      else
+        e->prev->next = e->next;
+      if (e->next != NULL)
+        e->next->prev = e->prev;
+      if (sub != NULL)
+        h->root = meld (h, h->root, sub);
+    }
+  e->child = e->next = e->prev = NULL;
+  h->elem_cnt--;
+}
+
+/* Returns the number of elements in H. */
+size_t
+heap_size (const struct heap *h) 
+{
+  ASSERT (h != NULL);
+
+  return h->elem_cnt;
+}
+
+/* Returns true if H is empty, false otherwise. */
+bool
+heap_empty (const struct heap *h) 
+{
+  ASSERT (h != NULL);
+
+  return h->root == NULL;
+}
+
+/* Returns true if A should leave heap H before B: A is greater,
+   or they are equal and A was inserted first. */
+static bool
+before (const struct heap *h,
+        const struct heap_elem *a, const struct heap_elem *b) 
+{
+  if (h->less (b, a, h->aux))
+    return true;
+  if (h->less (a, b, h->aux))
+    return false;
+  return (int) (a->seq - b->seq) < 0;
+}
+
+/* Joins the trees rooted at A and B, neither of which has
+   siblings, and returns the root of the result. */
+static struct heap_elem *
+meld (const struct heap *h, struct heap_elem *a, struct heap_elem *b) 
+{
+  if (before (h, b, a)) 
+    {
+      struct heap_elem *t = a;
+      a = b;
+      b = t;
+    }
+  b->prev = a;
+  b->next = a->child;
+  if (a->child != NULL)
+    a->child->prev = b;
+  a->child = b;
+  return a;
+}
+
+/* Joins the sibling trees starting at FIRST into one and returns
+   its root, or NULL if FIRST is NULL.  Melds them in pairs from
+   left to right, then melds the pairs from right to left. */
+static struct heap_elem *
+merge_pairs (const struct heap *h, struct heap_elem *first) 
+{
+  struct heap_elem *pairs = NULL;
+  struct heap_elem *root = NULL;
+
+  /* Left to right, collecting the pairs in reverse order. */
+  while (first != NULL) 
+    {
+      struct heap_elem *a = first;
+      struct heap_elem *b = a->next;
+
+      a->next = a->prev = NULL;
+      if (b != NULL) 
+        {
+          first = b->next;
+          b->next = b->prev = NULL;
+          a = meld (h, a, b);
+        }
+      else
+        first = NULL;
+      a->next = pairs;
+      pairs = a;
+    }
+
+  /* Right to left. */
+  while (pairs != NULL) 
+    {
+      struct heap_elem *next = pairs->next;
+
+      pairs->next = NULL;
+      root = root != NULL ? meld (h, root, pairs) : pairs;
+      pairs = next;
+    }
+  return root;
+}
@@ -0,0 +1,73 @@
+#ifndef __LIB_KERNEL_HEAP_H
+#define __LIB_KERNEL_HEAP_H
+
+/* Priority queue.
+
+   This is a pairing heap: inserting an element and looking at
+   the greatest one take constant time, and removing any element
+   takes O(log n) amortized time.  Elements that compare equal
+   come out in the order they were inserted.
+
+   Like the linked list, the heap does not use dynamic
+   allocation.  Instead, each structure that can potentially be
+   in a heap must embed a struct heap_elem member.  All of the
+   heap functions operate on these `struct heap_elem's.  The
+   heap_entry macro allows conversion from a struct heap_elem
+   back to a structure object that contains it.  This is the same
+   technique used in the linked list implementation.  Refer to
+   lib/kernel/list.h for a detailed explanation.
+
+   An element's key must not change while it is in a heap.  To
+   change it, remove the element, change the key, and insert the
+   element again. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Heap element. */
+struct heap_elem 
+  {
+    struct heap_elem *child;    /* First child. */
+    struct heap_elem *next;     /* Next sibling. */
+    struct heap_elem *prev;     /* Previous sibling, or parent if
+                                   this is a first child. */
+    unsigned seq;               /* Insertion order, breaks ties. */
+  };
+
+/* Converts pointer to heap element HEAP_ELEM into a pointer to
+   the structure that HEAP_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the heap element.  See the big comment at the top of
+   lib/kernel/list.h for an example. */
+#define heap_entry(HEAP_ELEM, STRUCT, MEMBER)           \
+        ((STRUCT *) ((uint8_t *) (HEAP_ELEM)            \
+                     - offsetof (STRUCT, MEMBER)))
+
+/* Compares the value of two heap elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool heap_less_func (const struct heap_elem *a,
+                             const struct heap_elem *b,
+                             void *aux);
+
+/* Heap. */
+struct heap 
+  {
+    struct heap_elem *root;     /* Greatest element, or NULL. */
+    size_t elem_cnt;            /* Number of elements. */
+    unsigned next_seq;          /* Sequence number of the next
+                                   element inserted. */
+    heap_less_func *less;       /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void heap_init (struct heap *, heap_less_func *, void *aux);
+void heap_push (struct heap *, struct heap_elem *);
+struct heap_elem *heap_top (const struct heap *);
+struct heap_elem *heap_pop (struct heap *);
+void heap_remove (struct heap *, struct heap_elem *);
+size_t heap_size (const struct heap *);
+bool heap_empty (const struct heap *);
+
+#endif /* lib/kernel/heap.h */
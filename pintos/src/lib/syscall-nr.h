@@ -28,7 +28,17 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_BLOCKSTAT,              /* Reads a block device's I/O statistics. */
+    SYS_FSYNC,                  /* Writes a file's data and metadata to disk. */
+    SYS_FDATASYNC,              /* Writes a file's data to disk. */
+    SYS_FALLOCATE,              /* Allocates disk space for a file. */
+    SYS_FTRUNCATE,              /* Changes the length of a file. */
+    SYS_DEFRAG,                 /* Makes a file's blocks contiguous. */
+
+    SYS_CNT                     /* Number of system calls. */
   };
 
 #endif /* lib/syscall-nr.h */
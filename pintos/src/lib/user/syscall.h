@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <blockstat.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +46,12 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+bool blockstat (int role, struct blockstat *);
+bool fsync (int fd);
+bool fdatasync (int fd);
+bool fallocate (int fd, unsigned offset, unsigned length);
+bool ftruncate (int fd, unsigned length);
+bool defrag (int fd);
+
 #endif /* lib/user/syscall.h */
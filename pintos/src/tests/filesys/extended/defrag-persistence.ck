@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_archive ({"a" => [random_bytes (4096)],
+		"b" => [random_bytes (4096)]});
+pass;
@@ -0,0 +1,55 @@
+/* Grows two files a block at a time, alternating between them and
+   syncing after each write so that their blocks interleave on
+   disk, then defragments one of them while both are open and
+   checks that neither file's data changed. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define BLOCK_CNT 8
+
+static char buf_a[BLOCK_SIZE * BLOCK_CNT];
+static char buf_b[BLOCK_SIZE * BLOCK_CNT];
+
+static void
+write_block (int fd, const char *buf, int i) 
+{
+  if (write (fd, buf + i * BLOCK_SIZE, BLOCK_SIZE) != BLOCK_SIZE)
+    fail ("write %d bytes at offset %d failed", BLOCK_SIZE, i * BLOCK_SIZE);
+  if (!fdatasync (fd))
+    fail ("sync after writing %d bytes failed", (i + 1) * BLOCK_SIZE);
+}
+
+void
+test_main (void) 
+{
+  int fd_a, fd_b;
+  int i;
+
+  random_init (0);
+  random_bytes (buf_a, sizeof buf_a);
+  random_bytes (buf_b, sizeof buf_b);
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK (create ("b", 0), "create \"b\"");
+  CHECK ((fd_a = open ("a")) > 1, "open \"a\"");
+  CHECK ((fd_b = open ("b")) > 1, "open \"b\"");
+  msg ("write \"a\" and \"b\" alternately");
+  for (i = 0; i < BLOCK_CNT; i++) 
+    {
+      write_block (fd_a, buf_a, i);
+      write_block (fd_b, buf_b, i);
+    }
+  CHECK (defrag (fd_a), "defrag \"a\"");
+  CHECK (defrag (fd_a), "defrag \"a\" again");
+  CHECK (!defrag (1234), "defrag on a bad fd fails");
+  msg ("close \"a\"");
+  close (fd_a);
+  msg ("close \"b\"");
+  close (fd_b);
+  check_file ("a", buf_a, sizeof buf_a);
+  check_file ("b", buf_b, sizeof buf_b);
+}
@@ -0,0 +1,30 @@
+/* Preallocates space for a file that already holds some data and
+   checks that the data survives and that the file grew to the
+   preallocated size, reading as zeros past the old end. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[20000];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  memcpy (buf, "hello", 5);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, 5) == 5, "write \"%s\"", file_name);
+  CHECK (fallocate (fd, 0, sizeof buf), "fallocate \"%s\"", file_name);
+  CHECK (filesize (fd) == sizeof buf, "filesize \"%s\"", file_name);
+  CHECK (fallocate (fd, 1000, 1000), "fallocate inside \"%s\"", file_name);
+  CHECK (filesize (fd) == sizeof buf, "filesize \"%s\"", file_name);
+  CHECK (!fallocate (1234, 0, 512), "fallocate on a bad fd fails");
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fallocate) begin
+(fallocate) create "testfile"
+(fallocate) open "testfile"
+(fallocate) write "testfile"
+(fallocate) fallocate "testfile"
+(fallocate) filesize "testfile"
+(fallocate) fallocate inside "testfile"
+(fallocate) filesize "testfile"
+(fallocate) fallocate on a bad fd fails
+(fallocate) close "testfile"
+(fallocate) open "testfile" for verification
+(fallocate) verified contents of "testfile"
+(fallocate) close "testfile"
+(fallocate) end
+EOF
+pass;
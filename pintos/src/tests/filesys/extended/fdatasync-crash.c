@@ -0,0 +1,38 @@
+/* Grows a file 1,234 bytes at a time, calling fdatasync() after
+   each write, with the kernel run with -journal-crash, which
+   stops the journal at the first commit.  Since the first write
+   grew the file, the first fdatasync() must commit its length
+   and block map as well as write its data, so at the next boot
+   the file holds those first 1,234 bytes.  fdatasync() on a bad
+   fd or the console fails. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/filesys/seq-test.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[5678];
+
+static size_t
+return_block_size (void) 
+{
+  return 1234;
+}
+
+static void
+sync_file (int fd, long ofs) 
+{
+  if (!fdatasync (fd))
+    fail ("fdatasync after writing %ld bytes failed", ofs);
+}
+
+void
+test_main (void) 
+{
+  seq_test ("testme",
+            buf, sizeof buf, 0,
+            return_block_size, sync_file);
+  CHECK (!fdatasync (1234), "fdatasync on a bad fd fails");
+  CHECK (!fdatasync (STDOUT_FILENO), "fdatasync on the console fails");
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fdatasync-crash) begin
+(fdatasync-crash) create "testme"
+(fdatasync-crash) open "testme"
+(fdatasync-crash) writing "testme"
+(fdatasync-crash) close "testme"
+(fdatasync-crash) open "testme" for verification
+(fdatasync-crash) verified contents of "testme"
+(fdatasync-crash) close "testme"
+(fdatasync-crash) fdatasync on a bad fd fails
+(fdatasync-crash) fdatasync on the console fails
+(fdatasync-crash) end
+EOF
+pass;
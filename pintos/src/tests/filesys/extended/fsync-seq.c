@@ -0,0 +1,33 @@
+/* Grows a file from 0 bytes to 5,678 bytes, 1,234 bytes at a
+   time, calling fsync() and fdatasync() alternately after each
+   write. */
+
+#include <syscall.h>
+#include "tests/filesys/seq-test.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[5678];
+
+static size_t
+return_block_size (void) 
+{
+  return 1234;
+}
+
+static void
+sync_file (int fd, long ofs) 
+{
+  bool synced = (ofs / 1234) % 2 ? fsync (fd) : fdatasync (fd);
+  if (!synced)
+    fail ("sync after writing %ld bytes failed", ofs);
+}
+
+void
+test_main (void) 
+{
+  seq_test ("testme",
+            buf, sizeof buf, 0,
+            return_block_size, sync_file);
+  CHECK (!fsync (1234), "fsync on a bad fd fails");
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsync-seq) begin
+(fsync-seq) create "testme"
+(fsync-seq) open "testme"
+(fsync-seq) writing "testme"
+(fsync-seq) close "testme"
+(fsync-seq) open "testme" for verification
+(fsync-seq) verified contents of "testme"
+(fsync-seq) close "testme"
+(fsync-seq) fsync on a bad fd fails
+(fsync-seq) end
+EOF
+pass;
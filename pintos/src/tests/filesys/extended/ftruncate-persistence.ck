@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_archive ({"testfile"
+		=> [substr (random_bytes (8192), 0, 1000) . ("\0" x 2000)]});
+pass;
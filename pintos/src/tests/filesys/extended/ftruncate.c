@@ -0,0 +1,49 @@
+/* Repeatedly fills a file with 1.2 MB, more than half of the
+   2 MB disk the tests run on, and truncates it back to 1,000
+   bytes.  The second round only fits if truncation freed the
+   blocks past the new end.  Then grows the file again and checks
+   that the new part reads as zeros. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Each round writes WRITE_CNT copies of BUF. */
+#define WRITE_CNT 150
+static char buf[8192];
+static char expected[3000];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+  int round, i;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+  memcpy (expected, buf, 1000);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (round = 0; round < 3; round++)
+    {
+      seek (fd, 0);
+      for (i = 0; i < WRITE_CNT; i++)
+        if (write (fd, buf, sizeof buf) != sizeof buf)
+          fail ("write %zu bytes at offset %zu failed",
+                sizeof buf, i * sizeof buf);
+      CHECK (ftruncate (fd, 1000), "ftruncate \"%s\" to 1000 bytes",
+             file_name);
+      CHECK (filesize (fd) == 1000, "filesize \"%s\"", file_name);
+    }
+  CHECK (ftruncate (fd, sizeof expected), "ftruncate \"%s\" to %zu bytes",
+         file_name, sizeof expected);
+  CHECK (filesize (fd) == sizeof expected, "filesize \"%s\"", file_name);
+  CHECK (!ftruncate (1234, 0), "ftruncate on a bad fd fails");
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, expected, sizeof expected);
+}
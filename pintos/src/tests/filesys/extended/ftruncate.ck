@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(ftruncate) begin
+(ftruncate) create "testfile"
+(ftruncate) open "testfile"
+(ftruncate) ftruncate "testfile" to 1000 bytes
+(ftruncate) filesize "testfile"
+(ftruncate) ftruncate "testfile" to 1000 bytes
+(ftruncate) filesize "testfile"
+(ftruncate) ftruncate "testfile" to 1000 bytes
+(ftruncate) filesize "testfile"
+(ftruncate) ftruncate "testfile" to 3000 bytes
+(ftruncate) filesize "testfile"
+(ftruncate) ftruncate on a bad fd fails
+(ftruncate) close "testfile"
+(ftruncate) open "testfile" for verification
+(ftruncate) verified contents of "testfile"
+(ftruncate) close "testfile"
+(ftruncate) end
+EOF
+pass;
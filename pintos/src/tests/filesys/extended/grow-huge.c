@@ -0,0 +1,49 @@
+/* Grows a file well past 8 MB, which takes the triply indirect
+   block, by writing at the end of a large hole, then writes and
+   reads back a few blocks near the end. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (64 * 1024 * 1024)
+
+static char buf[1234];
+static char data[1234];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  size_t i;
+  int fd;
+
+  random_init (0);
+  random_bytes (data, sizeof data);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, FILE_SIZE - sizeof data);
+  CHECK (write (fd, data, sizeof data) == (int) sizeof data,
+         "write \"%s\"", file_name);
+  CHECK (filesize (fd) == FILE_SIZE, "filesize \"%s\"", file_name);
+
+  msg ("read \"%s\"", file_name);
+  seek (fd, FILE_SIZE - sizeof data);
+  if (read (fd, buf, sizeof buf) != (int) sizeof buf)
+    fail ("read of data failed");
+  compare_bytes (buf, data, sizeof data, FILE_SIZE - sizeof data, file_name);
+  seek (fd, FILE_SIZE - 3 * sizeof buf);
+  if (read (fd, buf, sizeof buf) != (int) sizeof buf)
+    fail ("read of hole failed");
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != 0)
+      fail ("byte %zu of the hole is %d, not 0",
+            FILE_SIZE - 3 * sizeof buf + i, buf[i]);
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  CHECK (remove (file_name), "remove \"%s\"", file_name);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-huge) begin
+(grow-huge) create "testfile"
+(grow-huge) open "testfile"
+(grow-huge) seek "testfile"
+(grow-huge) write "testfile"
+(grow-huge) filesize "testfile"
+(grow-huge) read "testfile"
+(grow-huge) close "testfile"
+(grow-huge) remove "testfile"
+(grow-huge) end
+EOF
+pass;
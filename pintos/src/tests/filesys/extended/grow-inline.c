@@ -0,0 +1,22 @@
+/* Grows a file from 0 bytes to 1,000 bytes, 100 bytes at a time,
+   so that it outgrows the room for data in its inode partway
+   through. */
+
+#include "tests/filesys/seq-test.h"
+#include "tests/main.h"
+
+static char buf[1000];
+
+static size_t
+return_block_size (void) 
+{
+  return 100;
+}
+
+void
+test_main (void) 
+{
+  seq_test ("testme",
+            buf, sizeof buf, 0,
+            return_block_size, NULL);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-inline) begin
+(grow-inline) create "testme"
+(grow-inline) open "testme"
+(grow-inline) writing "testme"
+(grow-inline) close "testme"
+(grow-inline) open "testme" for verification
+(grow-inline) verified contents of "testme"
+(grow-inline) close "testme"
+(grow-inline) end
+EOF
+pass;
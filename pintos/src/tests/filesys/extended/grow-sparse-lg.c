@@ -0,0 +1,49 @@
+/* Seeks far past the end of a file, further than the file system
+   is large, and writes a few bytes.  Only the blocks written may
+   be allocated, and the hole in between must read as zeros. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HOLE_SIZE (4 * 1024 * 1024)
+
+static char buf[2345];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  const char data[] = "past the hole";
+  size_t i;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, HOLE_SIZE);
+  CHECK (write (fd, data, sizeof data) == (int) sizeof data,
+         "write \"%s\"", file_name);
+  CHECK (filesize (fd) == HOLE_SIZE + (int) sizeof data,
+         "filesize \"%s\"", file_name);
+
+  msg ("read hole of \"%s\"", file_name);
+  seek (fd, HOLE_SIZE / 2 - 1000);
+  if (read (fd, buf, sizeof buf) != (int) sizeof buf)
+    fail ("read of hole failed");
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != 0)
+      fail ("byte %zu of the hole is %d, not 0",
+            HOLE_SIZE / 2 - 1000 + i, buf[i]);
+
+  msg ("read data of \"%s\"", file_name);
+  seek (fd, HOLE_SIZE);
+  if (read (fd, buf, sizeof data) != (int) sizeof data)
+    fail ("read of data failed");
+  compare_bytes (buf, data, sizeof data, HOLE_SIZE, file_name);
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  CHECK (remove (file_name), "remove \"%s\"", file_name);
+}
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my (@output) = read_text_file ("$test.output");
+fail "journal was not replayed at boot\n"
+  if !grep (/^journal: replayed \d+ sectors of transaction \d+$/, @output);
+check_archive ({"a" => {"b" => [random_bytes (1234)]}});
+pass;
@@ -0,0 +1,35 @@
+/* Tests replay of the journal.  The kernel runs with
+   -journal-crash, so the commit asked for by the fsync() is
+   logged but never written to its home locations.  Directory
+   "a" and file "a/b" must still exist at the next boot, which
+   happens only if the log is replayed; "a/c", made after the
+   journal stopped, must not. */
+
+#include <syscall.h>
+#include "tests/filesys/seq-test.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[1234];
+
+static size_t
+return_block_size (void) 
+{
+  return sizeof buf;
+}
+
+static void
+sync_file (int fd, long ofs UNUSED) 
+{
+  CHECK (fsync (fd), "fsync \"a/b\"");
+}
+
+void
+test_main (void) 
+{
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  seq_test ("a/b",
+            buf, sizeof buf, 0,
+            return_block_size, sync_file);
+  CHECK (create ("a/c", 0), "create \"a/c\"");
+}
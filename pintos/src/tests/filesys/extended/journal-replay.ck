@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(journal-replay) begin
+(journal-replay) mkdir "a"
+(journal-replay) create "a/b"
+(journal-replay) open "a/b"
+(journal-replay) writing "a/b"
+(journal-replay) fsync "a/b"
+(journal-replay) close "a/b"
+(journal-replay) open "a/b" for verification
+(journal-replay) verified contents of "a/b"
+(journal-replay) close "a/b"
+(journal-replay) create "a/c"
+(journal-replay) end
+EOF
+pass;
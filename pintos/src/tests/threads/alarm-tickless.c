@@ -0,0 +1,41 @@
+/* Checks that the tick count stays true to real time when the
+   idle thread has stopped the periodic tick and another interrupt
+   ends the stretched period early.  The main thread stands in for
+   the idle thread: with interrupts off, it stretches the period,
+   busy-waits through part of it and then ends it as an interrupt
+   would.  Measured with the calibrated busy-wait loop, the ticks
+   that pass, both then and once the periodic tick is back, must
+   match. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+void
+test_alarm_tickless (void) 
+{
+  enum intr_level old_level;
+  int64_t start, elapsed;
+
+  /* Start just after the wheel's 64-tick boundary, so that the
+     period can be stretched as far as possible. */
+  timer_sleep (64 - timer_ticks () % 64 + 1);
+
+  old_level = intr_disable ();
+  start = timer_ticks ();
+  timer_idle_enter ();
+  timer_mdelay (25 * 1000 / TIMER_FREQ);
+  timer_idle_exit ();
+  elapsed = timer_elapsed (start);
+  intr_set_level (old_level);
+  if (elapsed < 1 || elapsed > 4)
+    fail ("%"PRId64" ticks accounted after 2.5 ticks", elapsed);
+
+  timer_mdelay (100 * 1000 / TIMER_FREQ);
+  elapsed = timer_elapsed (start);
+  if (elapsed < 10 || elapsed > 16)
+    fail ("%"PRId64" ticks counted over 12.5 ticks", elapsed);
+  pass ();
+}
@@ -0,0 +1,96 @@
+/* Sets timer callbacks that expire on both sides of the timer
+   wheel's 64-tick level boundary, both relative to the tick they
+   are set at and in absolute terms, plus one that has already
+   expired.  Each must be called at exactly the tick it expires,
+   or at the next tick for the one in the past.  Then a timer
+   that has been cascaded down a level is cancelled and must not
+   be called. */
+
+#include <stdio.h>
+#include <round.h>
+#include "tests/threads/tests.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+struct wheel_timer 
+  {
+    struct timer timer;         /* The timer. */
+    int64_t expires;            /* Tick it should be called at. */
+    int64_t fired;              /* Tick it was called at. */
+  };
+
+static struct semaphore done;
+static timer_func record_tick;
+
+void
+test_alarm_wheel (void) 
+{
+  struct wheel_timer timers[10], late;
+  enum intr_level old_level;
+  int64_t start, boundary;
+  size_t i;
+
+  sema_init (&done, 0);
+
+  /* Start 17 ticks past a 64-tick boundary, so that the timers
+     relative to START and to the next boundary differ. */
+  timer_sleep (64 - timer_ticks () % 64 + 17);
+
+  old_level = intr_disable ();
+  start = timer_ticks ();
+  boundary = ROUND_UP (start + 1, 64);
+  timers[0].expires = start - 5;
+  timers[1].expires = start + 1;
+  timers[2].expires = start + 63;
+  timers[3].expires = start + 64;
+  timers[4].expires = start + 65;
+  timers[5].expires = boundary - 1;
+  timers[6].expires = boundary;
+  timers[7].expires = boundary + 1;
+  timers[8].expires = boundary + 64;
+  timers[9].expires = boundary + 65;
+  for (i = 0; i < sizeof timers / sizeof *timers; i++) 
+    {
+      timers[i].fired = -1;
+      timer_set (&timers[i].timer, timers[i].expires, record_tick,
+                 &timers[i]);
+    }
+  intr_set_level (old_level);
+  timers[0].expires = start + 1;
+
+  for (i = 0; i < sizeof timers / sizeof *timers; i++)
+    sema_down (&done);
+  for (i = 0; i < sizeof timers / sizeof *timers; i++)
+    if (timers[i].fired != timers[i].expires)
+      fail ("timer %zu expiring at tick %"PRId64" called at tick %"PRId64,
+            i, timers[i].expires, timers[i].fired);
+  msg ("All timers were called at their tick.");
+
+  /* Set just after a boundary, LATE goes in the second level and
+     is cascaded into the first at the next boundary, 30 ticks
+     before it expires. */
+  timer_sleep (64 - timer_ticks () % 64 + 1);
+  boundary = ROUND_UP (timer_ticks (), 64);
+  late.fired = -1;
+  late.expires = boundary + 30;
+  timer_set (&late.timer, late.expires, record_tick, &late);
+  timer_sleep (boundary + 5 - timer_ticks ());
+  if (!timer_cancel (&late.timer))
+    fail ("cascaded timer was no longer pending");
+  timer_sleep (late.expires - timer_ticks () + 5);
+  if (late.fired != -1)
+    fail ("cancelled timer was called at tick %"PRId64, late.fired);
+  msg ("Cancelled timer was not called.");
+}
+
+/* Records the tick at which the wheel_timer AUX was called. */
+static void
+record_tick (void *aux) 
+{
+  struct wheel_timer *t = aux;
+
+  t->fired = timer_ticks ();
+  sema_up (&done);
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-wheel) begin
+(alarm-wheel) All timers were called at their tick.
+(alarm-wheel) Cancelled timer was not called.
+(alarm-wheel) end
+EOF
+pass;
@@ -0,0 +1,49 @@
+/* Run with -lockprof.  Initializes two locks at the same line, so
+   that they are profiled as one site, and acquires them three
+   times in all: once with lock_try_acquire(), once uncontended
+   and once while the main thread holds the lock for 10 ticks.
+   The statistics printed at shutdown must add up to that. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+static thread_func waiter_func;
+
+void
+test_lock_profile (void) 
+{
+  struct lock locks[2];
+  size_t i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  ASSERT (lock_profile);
+
+  for (i = 0; i < sizeof locks / sizeof *locks; i++)
+    lock_init (&locks[i]);
+
+  if (!lock_try_acquire (&locks[1]))
+    fail ("lock_try_acquire on a free lock failed");
+  lock_release (&locks[1]);
+
+  lock_acquire (&locks[0]);
+  thread_create ("waiter", PRI_DEFAULT + 1, waiter_func, &locks[0]);
+  msg ("Holding the lock for 10 ticks.");
+  timer_sleep (10);
+  lock_release (&locks[0]);
+  msg ("Waiter should have acquired the lock.");
+}
+
+static void
+waiter_func (void *lock_) 
+{
+  struct lock *lock = lock_;
+
+  lock_acquire (lock);
+  lock_release (lock);
+}
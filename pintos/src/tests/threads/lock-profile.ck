@@ -0,0 +1,29 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+check_expected ([<<'EOF']);
+(lock-profile) begin
+(lock-profile) Holding the lock for 10 ticks.
+(lock-profile) Waiter should have acquired the lock.
+(lock-profile) end
+EOF
+
+# The statistics are printed at shutdown.
+our ($test);
+my (@output) = read_text_file ("$test.output");
+my ($line) = grep (/lock-profile\.c:\d+: /, @output);
+fail "No statistics for the test's locks\n" if !defined $line;
+my ($acquires, $contended, $wait, $max_wait, $hold)
+  = $line =~ /: (\d+) acquires, (\d+) contended, (\d+) wait ticks \(max (\d+)\), (\d+) hold ticks/
+  or fail "Malformed statistics line: $line\n";
+fail "$acquires acquires counted, expected 3\n" if $acquires != 3;
+fail "$contended contended acquires counted, expected 1\n" if $contended != 1;
+fail "$wait wait ticks counted, expected about 10\n"
+  if $wait < 10 || $wait > 12;
+fail "Longest wait of $max_wait ticks, expected $wait\n"
+  if $max_wait != $wait;
+fail "$hold hold ticks counted, expected about 10\n"
+  if $hold < 10 || $hold > 13;
+pass;
@@ -0,0 +1,60 @@
+/* Checks that a thread that sleeps through some of the
+   once-a-second recent_cpu updates has the decays it missed
+   applied when it wakes up.  The main thread runs for 30 seconds,
+   sleeps for 3 and then runs for 3 more, printing its recent_cpu
+   and the load average just before it goes to sleep, just after it
+   wakes up and at the end.  The values must match those of a
+   scheduler that decays every thread every second. */
+
+#include <stdio.h>
+#include <round.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+static void report (int64_t start_time);
+static void spin_until (int64_t start_time, int seconds);
+
+void
+test_mlfqs_recent_sleep (void) 
+{
+  int64_t start_time;
+
+  ASSERT (thread_mlfqs);
+
+  /* Sensitive to assumption that recent_cpu updates happen exactly
+     when timer_ticks() % TIMER_FREQ == 0, so start on one. */
+  start_time = timer_ticks ();
+  timer_sleep (ROUND_UP (start_time + 1, TIMER_FREQ) - start_time);
+  start_time = timer_ticks ();
+
+  spin_until (start_time, 30);
+  report (start_time);
+  timer_sleep (start_time + 33 * TIMER_FREQ - timer_ticks ());
+  report (start_time);
+  spin_until (start_time, 36);
+  report (start_time);
+}
+
+/* Prints the current thread's recent_cpu and the load average,
+   with the number of seconds since START_TIME. */
+static void
+report (int64_t start_time) 
+{
+  int recent_cpu = thread_get_recent_cpu ();
+  int load_avg = thread_get_load_avg ();
+
+  msg ("After %d seconds, recent_cpu is %d.%02d, load_avg is %d.%02d.",
+       (int) (timer_elapsed (start_time) / TIMER_FREQ),
+       recent_cpu / 100, recent_cpu % 100,
+       load_avg / 100, load_avg % 100);
+}
+
+/* Busy-waits until SECONDS seconds after START_TIME. */
+static void
+spin_until (int64_t start_time, int seconds) 
+{
+  while (timer_elapsed (start_time) < seconds * TIMER_FREQ)
+    continue;
+}
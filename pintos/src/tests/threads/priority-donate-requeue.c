@@ -0,0 +1,90 @@
+/* Main thread M acquires lock A.  Thread F, at priority 32,
+   acquires lock B and then blocks on A, behind which thread S, at
+   priority 33, blocks too, so that S is A's best waiter.  Then
+   thread D, at priority 34, blocks on B and donates its priority
+   to F while F is waiting.  F must move ahead of S among A's
+   waiters, so when M releases A, F gets it first. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+struct locks 
+  {
+    struct lock *a;
+    struct lock *b;
+  };
+
+static thread_func first_thread_func;
+static thread_func second_thread_func;
+static thread_func donor_thread_func;
+
+void
+test_priority_donate_requeue (void) 
+{
+  struct lock a, b;
+  struct locks locks;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  lock_init (&a);
+  lock_init (&b);
+
+  lock_acquire (&a);
+
+  locks.a = &a;
+  locks.b = &b;
+  thread_create ("first", PRI_DEFAULT + 1, first_thread_func, &locks);
+  thread_create ("second", PRI_DEFAULT + 2, second_thread_func, &a);
+  msg ("Main thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 2, thread_get_priority ());
+
+  thread_create ("donor", PRI_DEFAULT + 3, donor_thread_func, &b);
+  msg ("Main thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 3, thread_get_priority ());
+
+  lock_release (&a);
+  msg ("Main thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT, thread_get_priority ());
+}
+
+static void
+first_thread_func (void *locks_) 
+{
+  struct locks *locks = locks_;
+
+  lock_acquire (locks->b);
+  lock_acquire (locks->a);
+  msg ("Thread first acquired lock a.");
+  lock_release (locks->a);
+  lock_release (locks->b);
+  msg ("Thread first finished.");
+}
+
+static void
+second_thread_func (void *lock_) 
+{
+  struct lock *lock = lock_;
+
+  lock_acquire (lock);
+  msg ("Thread second acquired lock a.");
+  lock_release (lock);
+  msg ("Thread second finished.");
+}
+
+static void
+donor_thread_func (void *lock_) 
+{
+  struct lock *lock = lock_;
+
+  lock_acquire (lock);
+  msg ("Thread donor acquired lock b.");
+  lock_release (lock);
+  msg ("Thread donor finished.");
+}
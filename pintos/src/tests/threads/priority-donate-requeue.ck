@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(priority-donate-requeue) begin
+(priority-donate-requeue) Main thread should have priority 33.  Actual priority: 33.
+(priority-donate-requeue) Main thread should have priority 34.  Actual priority: 34.
+(priority-donate-requeue) Thread first acquired lock a.
+(priority-donate-requeue) Thread donor acquired lock b.
+(priority-donate-requeue) Thread donor finished.
+(priority-donate-requeue) Thread second acquired lock a.
+(priority-donate-requeue) Thread second finished.
+(priority-donate-requeue) Thread first finished.
+(priority-donate-requeue) Main thread should have priority 31.  Actual priority: 31.
+(priority-donate-requeue) end
+EOF
+pass;
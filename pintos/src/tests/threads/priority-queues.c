@@ -0,0 +1,51 @@
+/* Creates threads at priorities on both sides of the 32-bit
+   halves of the ready queue mask, in scrambled order, and then
+   drops the main thread's priority.  They must run from highest
+   to lowest priority, and two threads at the same priority must
+   take turns in the order they were created. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/thread.h"
+
+static thread_func simple_thread_func;
+
+void
+test_priority_queues (void) 
+{
+  static const struct
+    {
+      const char *name;
+      int priority;
+    }
+  threads[] = 
+    {
+      {"31a", 31}, {"32a", 32}, {"1", 1}, {"62", 62},
+      {"33", 33}, {"30", 30}, {"32b", 32}, {"31b", 31},
+    };
+  size_t i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  thread_set_priority (PRI_MAX);
+  for (i = 0; i < sizeof threads / sizeof *threads; i++)
+    thread_create (threads[i].name, threads[i].priority,
+                   simple_thread_func, NULL);
+  msg ("Dropping to minimum priority.");
+  thread_set_priority (PRI_MIN);
+  msg ("All threads should have run by now.");
+}
+
+static void 
+simple_thread_func (void *aux UNUSED) 
+{
+  int i;
+  
+  for (i = 0; i < 2; i++) 
+    {
+      msg ("Thread %s iteration %d", thread_name (), i);
+      thread_yield ();
+    }
+}
@@ -0,0 +1,27 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(priority-queues) begin
+(priority-queues) Dropping to minimum priority.
+(priority-queues) Thread 62 iteration 0
+(priority-queues) Thread 62 iteration 1
+(priority-queues) Thread 33 iteration 0
+(priority-queues) Thread 33 iteration 1
+(priority-queues) Thread 32a iteration 0
+(priority-queues) Thread 32b iteration 0
+(priority-queues) Thread 32a iteration 1
+(priority-queues) Thread 32b iteration 1
+(priority-queues) Thread 31a iteration 0
+(priority-queues) Thread 31b iteration 0
+(priority-queues) Thread 31a iteration 1
+(priority-queues) Thread 31b iteration 1
+(priority-queues) Thread 30 iteration 0
+(priority-queues) Thread 30 iteration 1
+(priority-queues) Thread 1 iteration 0
+(priority-queues) Thread 1 iteration 1
+(priority-queues) All threads should have run by now.
+(priority-queues) end
+EOF
+pass;
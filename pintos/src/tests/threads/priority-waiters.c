@@ -0,0 +1,131 @@
+/* Tests the order in which sema_up() and cond_signal() wake
+   their waiters.  Threads at priorities 32 to 35 wait, some of
+   them at the same priority, and must wake highest priority
+   first and in the order they started waiting among equals.
+   One of them, at priority 32, holds a lock, and a thread at
+   priority 36 that blocks on that lock donates to it while it
+   waits, so it must be the first to wake. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func sema_waiter_func;
+static thread_func cond_waiter_func;
+static thread_func donor_func;
+static struct semaphore sema;
+static struct lock monitor;
+static struct condition condition;
+static struct lock donated;
+
+/* Waiters, in the order they are started. */
+static const struct
+  {
+    const char *name;
+    int priority;
+  }
+waiters[] = 
+  {
+    {"a", PRI_DEFAULT + 2}, {"b", PRI_DEFAULT + 4},
+    {"c", PRI_DEFAULT + 2}, {"holder", PRI_DEFAULT + 1},
+    {"d", PRI_DEFAULT + 4}, {"e", PRI_DEFAULT + 3},
+  };
+#define WAITER_CNT (sizeof waiters / sizeof *waiters)
+
+static void run_waiters (thread_func *, void (*wake) (void));
+static void wake_sema (void);
+static void wake_cond (void);
+
+void
+test_priority_waiters (void) 
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  sema_init (&sema, 0);
+  lock_init (&monitor);
+  cond_init (&condition);
+  lock_init (&donated);
+
+  msg ("Waking semaphore waiters.");
+  run_waiters (sema_waiter_func, wake_sema);
+  msg ("Signaling condition waiters.");
+  run_waiters (cond_waiter_func, wake_cond);
+}
+
+/* Starts the waiters running FUNC, each of which blocks at once,
+   has the donor donate to the one that holds DONATED, and then
+   calls WAKE once for each waiter. */
+static void
+run_waiters (thread_func *func, void (*wake) (void)) 
+{
+  size_t i;
+
+  for (i = 0; i < WAITER_CNT; i++)
+    thread_create (waiters[i].name, waiters[i].priority, func, NULL);
+  thread_create ("donor", PRI_DEFAULT + 5, donor_func, NULL);
+  for (i = 0; i < WAITER_CNT; i++)
+    wake ();
+}
+
+static void
+wake_sema (void) 
+{
+  sema_up (&sema);
+}
+
+static void
+wake_cond (void) 
+{
+  lock_acquire (&monitor);
+  cond_signal (&condition, &monitor);
+  lock_release (&monitor);
+}
+
+/* Takes DONATED if the current thread is the holder. */
+static bool
+hold_donated (void) 
+{
+  bool holder = thread_get_priority () == PRI_DEFAULT + 1;
+
+  if (holder)
+    lock_acquire (&donated);
+  return holder;
+}
+
+static void
+sema_waiter_func (void *aux UNUSED) 
+{
+  bool holder = hold_donated ();
+
+  sema_down (&sema);
+  msg ("Thread %s woke up.", thread_name ());
+  if (holder)
+    lock_release (&donated);
+}
+
+static void
+cond_waiter_func (void *aux UNUSED) 
+{
+  bool holder = hold_donated ();
+
+  lock_acquire (&monitor);
+  cond_wait (&condition, &monitor);
+  msg ("Thread %s woke up.", thread_name ());
+  lock_release (&monitor);
+  if (holder)
+    lock_release (&donated);
+}
+
+static void
+donor_func (void *aux UNUSED) 
+{
+  lock_acquire (&donated);
+  msg ("Thread donor acquired the lock.");
+  lock_release (&donated);
+}
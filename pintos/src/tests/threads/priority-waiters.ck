@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(priority-waiters) begin
+(priority-waiters) Waking semaphore waiters.
+(priority-waiters) Thread holder woke up.
+(priority-waiters) Thread donor acquired the lock.
+(priority-waiters) Thread b woke up.
+(priority-waiters) Thread d woke up.
+(priority-waiters) Thread e woke up.
+(priority-waiters) Thread a woke up.
+(priority-waiters) Thread c woke up.
+(priority-waiters) Signaling condition waiters.
+(priority-waiters) Thread holder woke up.
+(priority-waiters) Thread donor acquired the lock.
+(priority-waiters) Thread b woke up.
+(priority-waiters) Thread d woke up.
+(priority-waiters) Thread e woke up.
+(priority-waiters) Thread a woke up.
+(priority-waiters) Thread c woke up.
+(priority-waiters) end
+EOF
+pass;
@@ -0,0 +1,63 @@
+/* The main thread acquires an rwlock for reading.  A
+   higher-priority writer then waits for it, donating its
+   priority to the main thread, which is the reader it waits for.
+   A still higher-priority reader then waits behind the writer,
+   donating to the writer, and through it to the main thread.
+   When the main thread leaves, the writer and then the reader
+   should get in, and the main thread should be back at its own
+   priority. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func writer_thread_func;
+static thread_func reader_thread_func;
+
+void
+test_rwlock_donate (void) 
+{
+  struct rwlock rw;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rw);
+  rwlock_acquire_read (&rw);
+  thread_create ("writer", PRI_DEFAULT + 5, writer_thread_func, &rw);
+  msg ("Main thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 5, thread_get_priority ());
+  thread_create ("reader", PRI_DEFAULT + 10, reader_thread_func, &rw);
+  msg ("Main thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 10, thread_get_priority ());
+  rwlock_release_read (&rw);
+  msg ("Main thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT, thread_get_priority ());
+}
+
+static void
+writer_thread_func (void *rw_) 
+{
+  struct rwlock *rw = rw_;
+
+  rwlock_acquire_write (rw);
+  msg ("Writer acquired the lock.");
+  rwlock_release_write (rw);
+  msg ("Writer finished.");
+}
+
+static void
+reader_thread_func (void *rw_) 
+{
+  struct rwlock *rw = rw_;
+
+  rwlock_acquire_read (rw);
+  msg ("Reader acquired the lock.");
+  rwlock_release_read (rw);
+  msg ("Reader finished.");
+}
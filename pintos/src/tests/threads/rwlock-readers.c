@@ -0,0 +1,63 @@
+/* The main thread acquires an rwlock for reading, then creates
+   three higher-priority threads that acquire it for reading too.
+   None of them should block: all four readers are inside at
+   once.  Each reader then waits on a semaphore that the main
+   thread ups, and leaves, the highest priority first. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+struct rwlock_and_sema 
+  {
+    struct rwlock rw;
+    struct semaphore sema;
+  };
+
+static thread_func reader_thread_func;
+
+void
+test_rwlock_readers (void) 
+{
+  struct rwlock_and_sema rs;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rs.rw);
+  sema_init (&rs.sema, 0);
+  rwlock_acquire_read (&rs.rw);
+  if (rwlock_held_by_current_thread (&rs.rw)
+      && !rwlock_write_held_by_current_thread (&rs.rw))
+    msg ("Main thread holds the lock for reading.");
+  for (i = 0; i < 3; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "reader %d", i);
+      thread_create (name, PRI_DEFAULT + 1 + i, reader_thread_func, &rs);
+    }
+  msg ("%u readers inside.", rs.rw.readers);
+  for (i = 0; i < 3; i++)
+    sema_up (&rs.sema);
+  rwlock_release_read (&rs.rw);
+  if (!rwlock_held_by_current_thread (&rs.rw))
+    msg ("Main thread released the lock.");
+}
+
+static void
+reader_thread_func (void *rs_) 
+{
+  struct rwlock_and_sema *rs = rs_;
+
+  rwlock_acquire_read (&rs->rw);
+  msg ("%s acquired the lock for reading.", thread_name ());
+  sema_down (&rs->sema);
+  rwlock_release_read (&rs->rw);
+  msg ("%s finished.", thread_name ());
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-readers) begin
+(rwlock-readers) Main thread holds the lock for reading.
+(rwlock-readers) reader 0 acquired the lock for reading.
+(rwlock-readers) reader 1 acquired the lock for reading.
+(rwlock-readers) reader 2 acquired the lock for reading.
+(rwlock-readers) 4 readers inside.
+(rwlock-readers) reader 2 finished.
+(rwlock-readers) reader 1 finished.
+(rwlock-readers) reader 0 finished.
+(rwlock-readers) Main thread released the lock.
+(rwlock-readers) end
+EOF
+pass;
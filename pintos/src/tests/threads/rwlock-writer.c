@@ -0,0 +1,66 @@
+/* The main thread acquires an rwlock for reading.  A writer then
+   waits for it, and after the writer a reader of higher priority.
+   The writer must get in only once the main thread has left, and
+   the reader only once the writer has left, even though another
+   reader was inside when it arrived and it outranks the
+   writer. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func writer_thread_func;
+static thread_func reader_thread_func;
+
+/* Set while the writer is inside. */
+static bool writing;
+
+void
+test_rwlock_writer (void) 
+{
+  struct rwlock rw;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rw);
+  rwlock_acquire_read (&rw);
+  thread_create ("writer", PRI_DEFAULT + 2, writer_thread_func, &rw);
+  msg ("Writer is waiting.");
+  thread_create ("reader", PRI_DEFAULT + 3, reader_thread_func, &rw);
+  msg ("Reader is waiting.");
+  msg ("Main thread releasing the lock.");
+  rwlock_release_read (&rw);
+  msg ("Main thread finished.");
+}
+
+static void
+writer_thread_func (void *rw_) 
+{
+  struct rwlock *rw = rw_;
+
+  rwlock_acquire_write (rw);
+  writing = true;
+  msg ("Writer acquired the lock, %u readers inside.", rw->readers);
+  thread_yield ();
+  writing = false;
+  rwlock_release_write (rw);
+  msg ("Writer finished.");
+}
+
+static void
+reader_thread_func (void *rw_) 
+{
+  struct rwlock *rw = rw_;
+
+  rwlock_acquire_read (rw);
+  msg ("Reader acquired the lock, writer %s.",
+       writing ? "still inside" : "gone");
+  rwlock_release_read (rw);
+  msg ("Reader finished.");
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-writer) begin
+(rwlock-writer) Writer is waiting.
+(rwlock-writer) Reader is waiting.
+(rwlock-writer) Main thread releasing the lock.
+(rwlock-writer) Writer acquired the lock, 0 readers inside.
+(rwlock-writer) Reader acquired the lock, writer gone.
+(rwlock-writer) Reader finished.
+(rwlock-writer) Writer finished.
+(rwlock-writer) Main thread finished.
+(rwlock-writer) end
+EOF
+pass;
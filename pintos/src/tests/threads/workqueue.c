@@ -0,0 +1,59 @@
+/* Queues work at several priorities while the workers are still
+   asleep, then flushes the queue.  The work should run highest
+   priority first, first come first served among equals, each at
+   its own priority, and all of it before workqueue_flush()
+   returns.  Work that is cancelled should not run at all, and
+   flushing an empty queue should return at once. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/thread.h"
+#include "threads/workqueue.h"
+
+#define WORK_CNT 6
+
+static struct work works[WORK_CNT + 1];
+static const int priorities[WORK_CNT] = {3, 1, 5, 3, 2, 4};
+
+static work_func run_work;
+
+void
+test_workqueue (void) 
+{
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default, that of the workers,
+     so that they do not run before we flush. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  for (i = 0; i < WORK_CNT; i++) 
+    {
+      work_init (&works[i], run_work, (void *) i,
+                 PRI_DEFAULT + priorities[i]);
+      work_queue (&works[i]);
+    }
+  work_init (&works[WORK_CNT], run_work, (void *) WORK_CNT, PRI_MAX);
+  work_queue (&works[WORK_CNT]);
+  if (work_cancel (&works[WORK_CNT]))
+    msg ("Cancelled work %d.", WORK_CNT);
+  if (!work_queue (&works[0]))
+    msg ("Work 0 is already queued.");
+  msg ("Queued %d pieces of work.", WORK_CNT);
+
+  workqueue_flush ();
+  msg ("Flushed the queue.");
+  workqueue_flush ();
+  msg ("Flushed an empty queue.");
+}
+
+static void
+run_work (void *id_) 
+{
+  int id = (int) id_;
+
+  msg ("Work %d ran at priority %d.", id, thread_get_priority ());
+}
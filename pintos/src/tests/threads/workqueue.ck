@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(workqueue) begin
+(workqueue) Cancelled work 6.
+(workqueue) Work 0 is already queued.
+(workqueue) Queued 6 pieces of work.
+(workqueue) Work 2 ran at priority 36.
+(workqueue) Work 5 ran at priority 35.
+(workqueue) Work 0 ran at priority 34.
+(workqueue) Work 3 ran at priority 34.
+(workqueue) Work 4 ran at priority 33.
+(workqueue) Work 1 ran at priority 32.
+(workqueue) Flushed the queue.
+(workqueue) Flushed an empty queue.
+(workqueue) end
+EOF
+pass;
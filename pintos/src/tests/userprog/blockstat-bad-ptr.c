@@ -0,0 +1,13 @@
+/* Passes an invalid pointer to the blockstat system call.
+   The process must be terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  blockstat (BLOCKSTAT_FILESYS, (struct blockstat *) 0x10123420);
+  fail ("should have exited with -1");
+}
@@ -0,0 +1,14 @@
+/* Passes a pointer into the read-only code segment to the
+   blockstat system call, which must not write there.
+   The process must be terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  blockstat (BLOCKSTAT_FILESYS, (struct blockstat *) test_main);
+  fail ("should have exited with -1");
+}
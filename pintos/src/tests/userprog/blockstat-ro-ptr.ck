@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(blockstat-ro-ptr) begin
+blockstat-ro-ptr: exit(-1)
+EOF
+pass;
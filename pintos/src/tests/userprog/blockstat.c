@@ -0,0 +1,40 @@
+/* Reads the I/O statistics of the file system device, which this
+   program was loaded from, and checks that they add up.  Roles
+   that do not exist must be refused. */
+
+#include <blockstat.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Returns the number of requests counted in HIST. */
+static uint64_t
+hist_sum (const uint32_t hist[BLOCKSTAT_BUCKETS]) 
+{
+  uint64_t sum = 0;
+  int i;
+
+  for (i = 0; i < BLOCKSTAT_BUCKETS; i++)
+    sum += hist[i];
+  return sum;
+}
+
+void
+test_main (void) 
+{
+  struct blockstat st;
+
+  CHECK (blockstat (BLOCKSTAT_FILESYS, &st), "blockstat file system");
+  CHECK (st.read_cnt > 0, "sectors were read");
+  CHECK (st.read_bytes == st.read_cnt * 512
+         && st.write_bytes == st.write_cnt * 512,
+         "bytes match sectors");
+  CHECK (hist_sum (st.read_hist) == st.read_cnt
+         && hist_sum (st.write_hist) == st.write_cnt,
+         "histograms count every request");
+  CHECK (st.max_in_flight >= 1 && st.in_flight <= st.max_in_flight
+         && st.depth_sum >= st.read_cnt + st.write_cnt,
+         "queue depths are consistent");
+  CHECK (!blockstat (99, &st), "blockstat on a bad role fails");
+  CHECK (!blockstat (-1, &st), "blockstat on a negative role fails");
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(blockstat) begin
+(blockstat) blockstat file system
+(blockstat) sectors were read
+(blockstat) bytes match sectors
+(blockstat) histograms count every request
+(blockstat) queue depths are consistent
+(blockstat) blockstat on a bad role fails
+(blockstat) blockstat on a negative role fails
+(blockstat) end
+blockstat: exit(0)
+EOF
+pass;
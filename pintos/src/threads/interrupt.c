@@ -214,6 +214,25 @@ intr_context (void)
   return in_external_intr;
 }
 
+/* Returns true if external interrupt VEC_NO has been raised but
+   not yet delivered, for example because interrupts are off. */
+bool
+intr_pending (uint8_t vec_no) 
+{
+  int irq = vec_no - 0x20;
+
+  ASSERT (vec_no >= 0x20 && vec_no <= 0x2f);
+
+  /* OCW3: read the Interrupt Request Register. */
+  if (irq < 8)
+    {
+      outb (PIC0_CTRL, 0x0a);
+      return (inb (PIC0_CTRL) & (1 << irq)) != 0;
+    }
+  outb (PIC1_CTRL, 0x0a);
+  return (inb (PIC1_CTRL) & (1 << (irq - 8))) != 0;
+}
+
 /* During processing of an external interrupt, directs the
    interrupt handler to yield to a new process just before
    returning from the interrupt.  May not be called at any other
@@ -359,6 +378,12 @@ intr_handler (struct intr_frame *frame)
 
       in_external_intr = true;
       yield_on_return = false;
+
+      /* Any other device may wake a thread, so bring the clock
+         up to date and resume ticking if the idle thread had
+         stopped it. */
+      if (frame->vec_no != 0x20)
+        timer_idle_exit ();
     }
 
   /* Invoke the interrupt's handler. */
@@ -31,6 +31,35 @@
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "devices/timer.h"
+
+static heap_less_func sema_waiter_less;
+static heap_less_func cond_waiter_less;
+
+/* If true, lock_acquire() and lock_release() keep the statistics
+   below.  Controlled by kernel command-line option "-lockprof". */
+bool lock_profile;
+
+/* Statistics of the locks initialized at one place in the
+   source. */
+struct lock_site
+  {
+    const char *file;           /* Where lock_init() was called. */
+    int line;
+    int64_t acquires;           /* Times acquired. */
+    int64_t contended;          /* Times that had to wait. */
+    int64_t wait_ticks;         /* Timer ticks spent waiting. */
+    int64_t max_wait_ticks;     /* Longest single wait. */
+    int64_t hold_ticks;         /* Timer ticks spent held. */
+  };
+
+/* Sites are never freed.  Once they run out, the remaining locks
+   are counted in the last one. */
+#define LOCK_SITES 64
+static struct lock_site lock_sites[LOCK_SITES];
+static size_t lock_site_cnt;
+
+static struct lock_site *lock_site_lookup (const char *file, int line);
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -47,7 +76,16 @@ sema_init (struct semaphore *sema, unsigned value)
   ASSERT (sema != NULL);
 
   sema->value = value;
-  list_init (&sema->waiters);
+  heap_init (&sema->waiters, sema_waiter_less, NULL);
+}
+
+/* [20170765] Orders the waiters of a semaphore by priority. */
+static bool
+sema_waiter_less (const struct heap_elem *a, const struct heap_elem *b,
+                  void *aux UNUSED) 
+{
+  return heap_entry (a, struct thread, sema_elem)->priority
+    < heap_entry (b, struct thread, sema_elem)->priority;
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -68,8 +106,10 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      /*[20170765] add to the sema's waiter list and wait there*/
-      list_push_back(&sema->waiters,&thread_current ()->elem);
+      /*[20170765] join the sema's waiters and wait there*/
+      struct thread *cur = thread_current ();
+      cur->wait_on_sema = sema;
+      heap_push (&sema->waiters, &cur->sema_elem);
       thread_block ();
     }
   sema->value--;
@@ -115,19 +155,21 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   sema->value++;
-  if (!list_empty (&sema->waiters)){
-    if(list_size(&sema->waiters)>1)
-      {
-	list_sort(&sema->waiters,priority_compare,NULL);
-      }
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+  if (!heap_empty (&sema->waiters)){
+    /*[20170765] wake the waiter with the highest priority*/
+    struct thread *t = heap_entry (heap_pop (&sema->waiters),
+                                   struct thread, sema_elem);
+    t->wait_on_sema = NULL;
+    thread_unblock (t);
   }
 
   intr_set_level (old_level);
 }
 
 static void sema_test_helper (void *sema_);
+static heap_less_func lock_waiter_less;
+static struct rwlock_hold *rwlock_find_hold (struct thread *,
+                                             const struct rwlock *);
 
 /* Self-test for semaphores that makes control "ping-pong"
    between a pair of threads.  Insert calls to printf() to see
@@ -180,12 +222,24 @@ sema_test_helper (void *sema_)
    onerous, it's a good sign that a semaphore should be used,
    instead of a lock. */
 void
-lock_init (struct lock *lock)
+lock_init_at (struct lock *lock, const char *file, int line)
 {
   ASSERT (lock != NULL);
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  heap_init (&lock->waiters, lock_waiter_less, NULL);
+  lock->site = lock_site_lookup (file, line);
+  lock->acquired = 0;
+}
+
+/* [20170765] Orders the waiters of a lock by priority. */
+static bool
+lock_waiter_less (const struct heap_elem *a, const struct heap_elem *b,
+                  void *aux UNUSED) 
+{
+  return heap_entry (a, struct thread, d_elem)->priority
+    < heap_entry (b, struct thread, d_elem)->priority;
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -199,29 +253,51 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  struct lock_site *site;
+  enum intr_level old_level;
+  int64_t start, wait;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
+
+  site = lock->site;
+
+  old_level = intr_disable ();
 /*[20170765] If sema_try_down returns false,the thread will wait on the lock*/
   if(!sema_try_down(&lock->semaphore)){
       
-  /*[2017065] If the lock's holder's priority is lower, donate to the holder*/
-    if(lock->holder->priority < thread_current()->priority){
-      thread_current()->wait_on_lock = lock;
-      list_insert_ordered(&lock->holder->donations,&thread_current()->d_elem,
-			  donation_compare,NULL);
-
-      donate_priority(lock->holder);
-    }
+  /*[2017065] Join the lock's waiters, which donate to the holder*/
+    start = lock_profile ? timer_ticks () : 0;
+    cur->wait_on_lock = lock;
+    heap_push (&lock->waiters, &cur->d_elem);
+    donate_priority (lock->holder);
     sema_down (&lock->semaphore);
+    heap_remove (&lock->waiters, &cur->d_elem);
+    cur->wait_on_lock = NULL;
+    if (lock_profile)
+      {
+        wait = timer_ticks () - start;
+        site->contended++;
+        site->wait_ticks += wait;
+        if (wait > site->max_wait_ticks)
+          site->max_wait_ticks = wait;
+      }
   }
-  struct thread* cur = thread_current();
   lock->holder = cur;
+  if (lock_profile)
+    {
+      site->acquires++;
+      lock->acquired = timer_ticks ();
+    }
   
   /* [20170765] add the lock to the list of locks held by the thread*/
-  list_push_back(&thread_current()->holding_locks,&lock->elem);
-  cur->wait_on_lock=NULL;
-
+  list_push_back(&cur->holding_locks,&lock->elem);
+  /* the threads still waiting now donate to us */
+  if (!heap_empty (&lock->waiters))
+    donate_priority (cur);
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -235,15 +311,26 @@ lock_try_acquire (struct lock *lock)
 {
   bool success;
 
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
     {
       lock->holder = thread_current ();
       list_push_back(&thread_current()->holding_locks,&lock->elem);
+      if (lock_profile)
+        {
+          lock->site->acquires++;
+          lock->acquired = timer_ticks ();
+        }
+      if (!heap_empty (&lock->waiters))
+        donate_priority (thread_current ());
     }
+  intr_set_level (old_level);
   return success;
 }
 
@@ -261,25 +348,15 @@ lock_release (struct lock *lock)
 
   enum intr_level old_level;
   old_level = intr_disable();
-  /*[20170765] return donations from threads that are waiting on this lock*/ 
+  if (lock_profile)
+    lock->site->hold_ticks += timer_ticks () - lock->acquired;
   lock->holder = NULL;
-  struct thread * t = thread_current();
-  if(!list_empty(&t->donations)){
-    struct list_elem *e; 
-    struct thread* donator;
-    for(e=list_begin(&t->donations);e!=list_end(&t->donations);e=list_next(e))
-      {
-	donator = list_entry(e,struct thread,d_elem);
-	if (donator->wait_on_lock == lock){list_remove(e);}
-      }    
-    /*update the priority*/  
-    donate_priority(t);
-
-  }
-  donate_priority(thread_current());
   list_remove(&lock->elem);
   lock->elem.prev=NULL;
   lock->elem.next=NULL;
+  /*[20170765] return donations from threads that are waiting on this lock*/ 
+  if (!heap_empty (&lock->waiters))
+    donate_priority(thread_current());
   sema_up (&lock->semaphore);
   intr_set_level(old_level);
 
@@ -296,13 +373,23 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
-/* One semaphore in a list. */
+/* One semaphore in a condition's waiters. */
 struct semaphore_elem 
   {
-    struct list_elem elem;              /* List element. */
+    struct heap_elem elem;              /* Heap element. */
     struct semaphore semaphore;         /* This semaphore. */
+    struct thread *thread;              /* Thread waiting on it. */
   };
 
+/* [20170765] Orders the waiters of a condition by priority. */
+static bool
+cond_waiter_less (const struct heap_elem *a, const struct heap_elem *b,
+                  void *aux UNUSED) 
+{
+  return heap_entry (a, struct semaphore_elem, elem)->thread->priority
+    < heap_entry (b, struct semaphore_elem, elem)->thread->priority;
+}
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -311,7 +398,7 @@ cond_init (struct condition *cond)
 {
   ASSERT (cond != NULL);
 
-  list_init (&cond->waiters);
+  heap_init (&cond->waiters, cond_waiter_less, NULL);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -338,6 +425,7 @@ void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
   struct semaphore_elem waiter;
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
@@ -346,32 +434,17 @@ cond_wait (struct condition *cond, struct lock *lock)
   
   //20170765
   sema_init (&waiter.semaphore, 0);
-  list_push_back (&cond->waiters, &waiter.elem);
+  waiter.thread = thread_current ();
+  old_level = intr_disable ();
+  heap_push (&cond->waiters, &waiter.elem);
+  waiter.thread->wait_on_cond = cond;
+  waiter.thread->cond_elem = &waiter.elem;
+  intr_set_level (old_level);
   lock_release (lock);
   sema_down (&waiter.semaphore);
   lock_acquire (lock);
 }
 
-static bool cond_compare (const struct list_elem *a, const struct list_elem *b,
-		   void *aux UNUSED){
-  
-  struct semaphore sema_a = 
-    list_entry(a,struct semaphore_elem, elem)->semaphore;
-
-  struct semaphore sema_b = 
-    list_entry(b,struct semaphore_elem, elem)->semaphore; 
-
-  struct thread* t_a = 
-    list_entry( list_front(&sema_a.waiters),struct thread, elem);
-
-  struct thread* t_b = 
-    list_entry( list_front(&sema_b.waiters),struct thread, elem);
-
-  return  t_a->priority < t_b->priority;
-}
-
-
-
 /* If any threads are waiting on COND (protected by LOCK), then
    this function signals one of them to wake up from its wait.
    LOCK must be held before calling this function.
@@ -382,23 +455,22 @@ static bool cond_compare (const struct list_elem *a, const struct list_elem *b,
 void
 cond_signal (struct condition *cond, struct lock *lock UNUSED) 
 {
+  enum intr_level old_level;
+
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!list_empty (&cond->waiters)){ 
-    //20170765
-    struct list_elem* e = list_max(&cond->waiters,cond_compare,NULL);
-    if(e!=list_end(&cond->waiters))
-      {
-	struct semaphore_elem* sema_elem = 
-	  list_entry (e, struct semaphore_elem, elem);
-	
-	list_remove(e);
-	sema_up(&sema_elem->semaphore);
-      }
+  old_level = intr_disable ();
+  if (!heap_empty (&cond->waiters)){ 
+    //20170765 signal the waiter with the highest priority
+    struct semaphore_elem* sema_elem = 
+      heap_entry (heap_pop (&cond->waiters), struct semaphore_elem, elem);
+    sema_elem->thread->wait_on_cond = NULL;
+    sema_up(&sema_elem->semaphore);
   }
+  intr_set_level (old_level);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -413,6 +485,279 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
 
-  while (!list_empty (&cond->waiters))
+  while (!heap_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RW.  A reader-writer lock can be held by any number
+   of readers at once, or by a single writer.
+
+   Both readers and writers go in through RW's writer lock, an
+   ordinary lock that a writer keeps until it is done and a reader
+   gives up as soon as it has counted itself in.  Waiting threads
+   are therefore let in in order of priority, first come first
+   served among equals, and they donate their priority to a writer
+   that holds the lock.  Once a writer has it, readers that arrive
+   later wait behind it: the writer only waits for the readers
+   already inside to leave, and meanwhile donates its priority to
+   them.  A thread that holds RW for reading must not acquire it
+   again, since a writer may be waiting in between. */
+void
+rwlock_init_at (struct rwlock *rw, const char *file, int line) 
+{
+  ASSERT (rw != NULL);
+
+  lock_init_at (&rw->writer, file, line);
+  rw->readers = 0;
+  list_init (&rw->holders);
+  rw->draining = false;
+  sema_init (&rw->drained, 0);
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   waits for it with a priority at least as high as ours. */
+void
+rwlock_acquire_read (struct rwlock *rw) 
+{
+  struct thread *cur = thread_current ();
+  struct rwlock_hold *hold;
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!rwlock_held_by_current_thread (rw));
+
+  hold = rwlock_find_hold (cur, NULL);
+  ASSERT (hold != NULL);
+  lock_acquire (&rw->writer);
+  old_level = intr_disable ();
+  rw->readers++;
+  hold->rw = rw;
+  hold->thread = cur;
+  list_push_back (&rw->holders, &hold->elem);
+  intr_set_level (old_level);
+  lock_release (&rw->writer);
+}
+
+/* Releases RW, which the current thread holds for reading. */
+void
+rwlock_release_read (struct rwlock *rw) 
+{
+  enum intr_level old_level;
+
+  struct rwlock_hold *hold;
+
+  ASSERT (rw != NULL);
+
+  old_level = intr_disable ();
+  hold = rwlock_find_hold (thread_current (), rw);
+  ASSERT (hold != NULL);
+  ASSERT (rw->readers > 0);
+  list_remove (&hold->elem);
+  hold->rw = NULL;
+  /* give back what a waiting writer donated */
+  donate_priority (thread_current ());
+  if (--rw->readers == 0 && rw->draining)
+    {
+      rw->draining = false;
+      sema_up (&rw->drained);
+    }
+  check_preempt_current ();
+  intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it. */
+void
+rwlock_acquire_write (struct rwlock *rw) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  struct list_elem *e;
+
+  ASSERT (rw != NULL);
+  ASSERT (!rwlock_held_by_current_thread (rw));
+
+  lock_acquire (&rw->writer);
+  old_level = intr_disable ();
+  if (rw->readers > 0)
+    {
+      rw->draining = true;
+      cur->wait_on_rwlock = rw;
+      for (e = list_begin (&rw->holders); e != list_end (&rw->holders);
+           e = list_next (e))
+        donate_priority (list_entry (e, struct rwlock_hold, elem)->thread);
+      sema_down (&rw->drained);
+      cur->wait_on_rwlock = NULL;
+    }
+  intr_set_level (old_level);
+}
+
+/* Tries to acquire RW for writing without sleeping.  Returns
+   true if successful, false if another thread holds it in either
+   mode. */
+bool
+rwlock_try_acquire_write (struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+
+  if (!lock_try_acquire (&rw->writer))
+    return false;
+  if (rw->readers > 0)
+    {
+      lock_release (&rw->writer);
+      return false;
+    }
+  return true;
+}
+
+/* Releases RW, which the current thread holds for writing. */
+void
+rwlock_release_write (struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+  ASSERT (rw->readers == 0);
+
+  lock_release (&rw->writer);
+}
+
+/* Returns true if the current thread holds RW, for reading or
+   for writing. */
+bool
+rwlock_held_by_current_thread (const struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+
+  return (rwlock_write_held_by_current_thread (rw)
+          || rwlock_find_hold (thread_current (), rw) != NULL);
+}
+
+/* Returns true if the current thread holds RW for writing. */
+bool
+rwlock_write_held_by_current_thread (const struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+
+  return lock_held_by_current_thread (&rw->writer);
+}
+
+/* Returns T's hold on RW for reading, or, if RW is null, a hold
+   that T is not using.  Returns a null pointer if there is
+   none. */
+static struct rwlock_hold *
+rwlock_find_hold (struct thread *t, const struct rwlock *rw) 
+{
+  int i;
+
+  for (i = 0; i < RWLOCK_HOLDS; i++)
+    if (t->reading[i].rw == rw)
+      return &t->reading[i];
+  return NULL;
+}
+
+/* Returns the statistics of the locks initialized at LINE of
+   FILE, creating them if necessary. */
+static struct lock_site *
+lock_site_lookup (const char *file, int line) 
+{
+  struct lock_site *site;
+  enum intr_level old_level;
+  size_t i;
+
+  old_level = intr_disable ();
+  for (i = 0; i < lock_site_cnt; i++)
+    {
+      site = &lock_sites[i];
+      if (site->line == line && !strcmp (site->file, file))
+        break;
+    }
+  if (i == lock_site_cnt)
+    {
+      if (lock_site_cnt < LOCK_SITES)
+        lock_site_cnt++;
+      else
+        {
+          i = LOCK_SITES - 1;
+          file = "(other)";
+          line = 0;
+        }
+      site = &lock_sites[i];
+      site->file = file;
+      site->line = line;
+    }
+  intr_set_level (old_level);
+  return site;
+}
+
+/* Prints lock contention statistics, most waited on first, if
+   profiling is on. */
+void
+lock_print_stats (void) 
+{
+  struct lock_site *order[LOCK_SITES], *site;
+  size_t cnt, i, j;
+
+  if (!lock_profile)
+    return;
+
+  /* Insertion sort by wait ticks, then by contended acquires. */
+  cnt = 0;
+  for (i = 0; i < lock_site_cnt; i++)
+    {
+      site = &lock_sites[i];
+      if (site->acquires == 0)
+        continue;
+      for (j = cnt; j > 0; j--)
+        {
+          struct lock_site *prev = order[j - 1];
+          if (prev->wait_ticks > site->wait_ticks
+              || (prev->wait_ticks == site->wait_ticks
+                  && prev->contended >= site->contended))
+            break;
+          order[j] = prev;
+        }
+      order[j] = site;
+      cnt++;
+    }
+
+  printf ("Locks: %zu sites acquired\n", cnt);
+  for (i = 0; i < cnt; i++)
+    {
+      site = order[i];
+      printf ("  %s:%d: %lld acquires, %lld contended, "
+              "%lld wait ticks (max %lld), %lld hold ticks\n",
+              site->file, site->line, site->acquires, site->contended,
+              site->wait_ticks, site->max_wait_ticks, site->hold_ticks);
+    }
+}
+
+/* [20170765] Takes thread T out of the heaps of waiters that are
+   ordered by its priority, so that its priority can change.
+   synch_requeue() puts it back.  Must be called with interrupts
+   off. */
+void
+synch_unqueue (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->wait_on_sema != NULL)
+    heap_remove (&t->wait_on_sema->waiters, &t->sema_elem);
+  if (t->wait_on_lock != NULL)
+    heap_remove (&t->wait_on_lock->waiters, &t->d_elem);
+  if (t->wait_on_cond != NULL)
+    heap_remove (&t->wait_on_cond->waiters, t->cond_elem);
+}
+
+/* [20170765] Puts thread T back into the heaps synch_unqueue()
+   took it out of. */
+void
+synch_requeue (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->wait_on_sema != NULL)
+    heap_push (&t->wait_on_sema->waiters, &t->sema_elem);
+  if (t->wait_on_lock != NULL)
+    heap_push (&t->wait_on_lock->waiters, &t->d_elem);
+  if (t->wait_on_cond != NULL)
+    heap_push (&t->wait_on_cond->waiters, t->cond_elem);
+}
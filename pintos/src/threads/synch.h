@@ -1,14 +1,17 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* A counting semaphore. */
 struct semaphore 
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct heap waiters;        /* Waiting threads, highest priority
+                                   first. */
   };
 
 void sema_init (struct semaphore *, unsigned value);
@@ -23,9 +26,16 @@ struct lock
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
     struct list_elem elem; //to be stored in the holders lock list
+    struct heap waiters;        /* Threads waiting for the lock, highest
+                                   priority first. */
+    struct lock_site *site;     /* Where the lock was initialized. */
+    int64_t acquired;           /* Tick the holder acquired it at. */
   };
 
-void lock_init (struct lock *);
+/* Locks are profiled by the place in the source that initializes
+   them, so that, say, all the buffer cache's locks add up. */
+#define lock_init(LOCK) lock_init_at (LOCK, __FILE__, __LINE__)
+void lock_init_at (struct lock *, const char *file, int line);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
@@ -34,7 +44,8 @@ bool lock_held_by_current_thread (const struct lock *);
 /* Condition variable. */
 struct condition 
   {
-    struct list waiters;        /* List of waiting threads. */
+    struct heap waiters;        /* Waiting threads, highest priority
+                                   first. */
   };
 
 void cond_init (struct condition *);
@@ -42,6 +53,48 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Reader-writer lock. */
+struct rwlock 
+  {
+    struct lock writer;         /* Held by the writer; readers pass
+                                   through it on the way in. */
+    unsigned readers;           /* Number of readers inside. */
+    struct list holders;        /* Their rwlock_holds. */
+    bool draining;              /* Writer waits for READERS to reach
+                                   0. */
+    struct semaphore drained;   /* Upped when they have. */
+  };
+
+/* A thread's hold on an rwlock it has acquired for reading.  A
+   writer waiting for the readers to leave donates its priority to
+   each of them through these. */
+#define RWLOCK_HOLDS 8          /* Read holds per thread. */
+struct rwlock_hold 
+  {
+    struct list_elem elem;      /* In RW's holders. */
+    struct rwlock *rw;          /* Lock held, or null if unused. */
+    struct thread *thread;      /* Thread holding it. */
+  };
+
+#define rwlock_init(RW) rwlock_init_at (RW, __FILE__, __LINE__)
+void rwlock_init_at (struct rwlock *, const char *file, int line);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+bool rwlock_try_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_by_current_thread (const struct rwlock *);
+bool rwlock_write_held_by_current_thread (const struct rwlock *);
+
+/* Lock contention profiling, turned on by the -lockprof option. */
+extern bool lock_profile;
+void lock_print_stats (void);
+
+/* [20170765] Priority changes of waiting threads. */
+struct thread;
+void synch_unqueue (struct thread *);
+void synch_requeue (struct thread *);
+
 
 /* Optimization barrier.
 
@@ -12,6 +12,7 @@
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "threads/fixed-points.h" 
+#include "devices/timer.h"
 #include <limits.h> 	
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -24,23 +25,17 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* [20170765] maximum and minimum of nice value that a thread can have*/
-#define NICE_MAX 20
-#define NICE_MIN -20
-
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running, one FIFO queue per
+   priority.  Bit P of READY_MASK is set iff READY_QUEUES[P] is
+   not empty, so the highest ready priority is one bit scan. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_mask;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
-/* [20170765] list of all process in THREAD_BLOCKED state. 
-Processes in this list are either sleeping until certain time,
- or waiting for either a lock, sema or cond*/
-static struct list sleep_list;
-
 
 /* Idle thread. */
 static struct thread *idle_thread;
@@ -77,8 +72,17 @@ bool thread_mlfqs;
 
 /* [20170765] Only used in 4.4BSD scheduler*/
 static f_p load_avg;		/* the average load of the cpu*/
-static int ready_threads;	/* # of threads in ready lists or
-                                     threads that are running*/
+static int ready_threads;	/* # of threads in the ready queues */
+
+/* Once a second every thread's recent_cpu decays by a factor that
+   depends on load_avg.  Ready and running threads are decayed on
+   time; a blocked thread catches up on the decays it missed when
+   it is unblocked, using the factors of the last DECAY_HISTORY
+   seconds. */
+#define DECAY_HISTORY 64
+static f_p decay_history[DECAY_HISTORY]; /* factor of second S is at
+					    S % DECAY_HISTORY */
+static int64_t decay_epoch;	/* # of once-a-second decays so far */
 
 
 static void kernel_thread (thread_func *, void *aux);
@@ -92,10 +96,11 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
-bool priority_compare (const struct list_elem *a, const struct list_elem *b,
-			      void *aux UNUSED);
-bool sleep_compare (const struct list_elem *a, const struct list_elem *b,
-                                   void *aux UNUSED);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static int ready_highest (void);
+static f_p recent_cpu_decay (void);
+static void mlfqs_refresh (struct thread *);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -113,12 +118,15 @@ bool sleep_compare (const struct list_elem *a, const struct list_elem *b,
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = PRI_MIN; i <= PRI_MAX; i++)
+    list_init (&ready_queues[i]);
+  ready_mask = 0;
   list_init (&all_list);
-  list_init (&sleep_list);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -252,6 +260,7 @@ thread_create (const char *name, int priority,
     {
       t->nice = parent->nice;
       t->recent_cpu = parent->recent_cpu;
+      t->recent_cpu_epoch = parent->recent_cpu_epoch;
       /*since t inherits nice and recent cpu from parent, it also
 	inherits the parent's priority*/
       t->priority = parent->priority;
@@ -260,7 +269,7 @@ thread_create (const char *name, int priority,
   t->current_dir = parent->current_dir;
   intr_set_level (old_level);
 
-  /* Add to run queue. */ //meaning insert to ready_list
+  /* Add to run queue. */
   thread_unblock (t);
 
   //compare priority with the running thread,and preempt if possible
@@ -294,9 +303,8 @@ thread_block (void)
    it may expect that it can atomically unblock a thread and
    update other data. 
  
- [20170765] when inserting the to-sleep thread to sleep_list,
-  it is inserted in the older of the thread's priority, by using
-  list_insert_ordered with the comparator "priority_compare".
+ [20170765] the thread goes to the back of the ready queue of
+  its priority.
 
   After it is in the ready queue, check_preempt_current()
   is called. If thread t has the higher priority than the 
@@ -310,66 +318,17 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_insert_ordered(&ready_list,&t->elem,priority_compare,NULL);
+  /* [20170765] apply the decays t missed while blocked */
+  if (thread_mlfqs)
+    mlfqs_refresh (t);
   t->status = THREAD_READY;
-  t->wake_up_at = INT_MAX;
+  ready_push (t);
 
   //preemption
   check_preempt_current();
   intr_set_level (old_level);
 }
 
-/* [20170765] called by timer_sleep(), make the current running 
-  thread sleep until TICKS ticks has passed. 
-  This function will insert the thread's sleepelem into sleep_list,
-  sorted by its priority, and set its waking up time to ticks. 
-  Then it will call thread_block to block this thread
-  and schedule again.
-*/
-void thread_sleep(int64_t ticks)
-{
-  struct thread* cur;
-  enum intr_level old_level;
-
-  ASSERT(!intr_context());
-  
-  cur = thread_current();
-  
-  old_level = intr_disable();
-  if(cur!=idle_thread)
-    {
-      list_insert_ordered(&sleep_list,&cur->sleepelem,sleep_compare,NULL);
-      cur->wake_up_at = ticks;
-    }
-  thread_block();
-  intr_set_level(old_level);
-}
-
-/* [20170765] called by timer_interrupt() at every tick to wake up 
-any threads if their wake up time has come. That is, the global tick
-is larger or equal to the thread's wake up time. 
-*/
-void thread_wake(int64_t ticks)
-{
-
-  if(list_empty(&sleep_list)){return;}
-  struct list_elem *e = list_begin(&sleep_list);
-  while(e!=list_end(&sleep_list))
-    {
-      struct thread* sleeping = list_entry(e,struct thread,sleepelem);
-      if(ticks>=sleeping->wake_up_at)
-	{
-	  list_remove(&sleeping->sleepelem);
-	  thread_unblock(sleeping);
-	}
-      e=list_next(e);
-    }
-
-
-
-}
-
-
 /* Returns the name of the running thread. */
 const char *
 thread_name (void) 
@@ -427,9 +386,8 @@ thread_exit (void)
 
 /* Yields the CPU.  The current thread is not put to sleep and
    may be scheduled again immediately at the scheduler's whim.
-  [20170765]except when thread_yield() is called by lock_acquire().
-  In that case the yielding thread will be put to sleep 
-  as it is waiting for a lock*/
+   A thread preempted inside lock_acquire() yields like any other;
+   it goes on to wait on the lock's semaphore once it runs again. */
 void
 thread_yield (void) 
 {
@@ -439,18 +397,11 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread){ 
-     list_insert_ordered(&ready_list,&cur->elem,priority_compare,NULL);
-  }
-   /*[20170765], if current thread is yielding because it is waiting on a lock,
-     block it*/ 
-  if(cur->wait_on_lock){thread_block();}
-  else{
-    cur->status = THREAD_READY;
-    schedule ();
-    intr_set_level (old_level);
-  }
-
+  cur->status = THREAD_READY;
+  if (cur != idle_thread) 
+    ready_push (cur);
+  schedule ();
+  intr_set_level (old_level);
 }
 
 /* Invoke function 'func' on all threads, passing along 'aux'.
@@ -486,13 +437,7 @@ thread_set_priority (int new_priority)
 
   /* the thread's new priority will be the maximum of 
   its new base priority and the donation it has received*/
-  if(thread_current()->priority<new_priority||
-		list_empty(&thread_current()->donations))
- {
-	thread_current()->priority=new_priority;
- }
-  /*sort the ready list again as the priority has been updated*/
-  list_sort(&ready_list, &priority_compare,NULL);
+  donate_priority(thread_current());
   /*if the new priority is the highest, schedule it immediately*/
   check_preempt_current();
   intr_set_level(old_level);
@@ -505,13 +450,22 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* [20170765] Sets the current thread's nice value to NICE. */
+/* [20170765] Sets the current thread's nice value to NICE, and
+   yields if that leaves it below a ready thread's priority. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
+  enum intr_level old_level;
+
   ASSERT(nice>=NICE_MIN &&nice<=NICE_MAX);
+  old_level = intr_disable ();
   thread_current()->nice = nice;
-	
+  if (thread_mlfqs)
+    {
+      mlfqs_refresh (thread_current ());
+      check_preempt_current ();
+    }
+  intr_set_level (old_level);
 }
 
 /* [20170765] Returns the thread t's nice value. */
@@ -549,11 +503,26 @@ thread_get_recent_cpu (void)
   return f_to_n_nearest(thread_current()->recent_cpu*100);
 }
 
-/* [20170765] update the thread t's recent cpu*/
+/* [20170765] update the thread t's recent cpu, applying the
+   once-a-second decays it has not seen yet.  A thread that missed
+   more than DECAY_HISTORY of them gets at most DECAY_HISTORY more
+   with the oldest recorded factor, by which time recent_cpu has
+   all but reached the value further decays would converge to. */
 void
 thread_set_t_recent_cpu(struct thread* t)
 {
-  t->recent_cpu = calculate_t_recent_cpu(t);
+  int64_t missed = decay_epoch - t->recent_cpu_epoch;
+  int64_t oldest = decay_epoch - DECAY_HISTORY;
+  int64_t s;
+
+  if (missed > 2 * DECAY_HISTORY)
+    missed = 2 * DECAY_HISTORY;
+  for (s = decay_epoch - missed; s < decay_epoch; s++)
+    {
+      f_p decay = decay_history[(s < oldest ? oldest : s) % DECAY_HISTORY];
+      t->recent_cpu = add_x_n(mul_x_y(decay,t->recent_cpu),t->nice);
+    }
+  t->recent_cpu_epoch = decay_epoch;
 }
 
 /*Increment the recent_cpu of the current thread's recent_cpu by 1*/
@@ -567,9 +536,9 @@ f_p calculate_load_avg(void)
 {
   f_p term1 = div_x_n(mul_x_n(load_avg,59),60);
   
-  /* [20170765] calculate and return the newest recent cpu of the thread t*/
-  int ready_threads = list_size(&all_list)-list_size(&sleep_list)-1;
-  f_p term2 = div_x_n(n_to_f(ready_threads),60);
+  /* threads that are ready or running, not counting the idle thread */
+  int ready = ready_threads + (thread_current() != idle_thread);
+  f_p term2 = div_x_n(n_to_f(ready),60);
   load_avg = add_x_y(term1,term2);
   return load_avg;
 }
@@ -580,7 +549,7 @@ f_p calculate_t_recent_cpu(struct thread* t)
   ASSERT(is_thread(t));
   f_p recent_cpu = t->recent_cpu;
   int nice = thread_get_t_nice(t);
-  f_p decay = div_x_y(mul_x_n(load_avg,2),mul_x_n(load_avg,2)+n_to_f(1));
+  f_p decay = recent_cpu_decay();
   f_p new_recent_cpu = add_x_n(mul_x_y(decay,recent_cpu),nice);
   return new_recent_cpu;
 }
@@ -592,45 +561,81 @@ int calculate_t_priority(struct thread* t)
   int recent_cpu =thread_get_t_recent_cpu(t)/100;
   int nice = thread_get_t_nice(t);
   int priority = PRI_MAX - (recent_cpu/4)-(nice*2);
+  if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  else if (priority < PRI_MIN)
+    priority = PRI_MIN;
   return priority; 
 }
 
 
+/* Returns the factor recent_cpu decays by, given load_avg. */
+static f_p
+recent_cpu_decay (void)
+{
+  return div_x_y(mul_x_n(load_avg,2),mul_x_n(load_avg,2)+n_to_f(1));
+}
+
+/* Brings T's recent_cpu and priority up to date. */
+static void
+mlfqs_refresh (struct thread *t)
+{
+  thread_set_t_recent_cpu(t);
+  thread_change_priority(t, calculate_t_priority(t));
+}
+
 /*called by timer interrupt at every tick thus, this functions runs in
-  interrupt context.checks if load_ag, recent_cpu and priority needs
-  to be upadted and update them.*/
+  interrupt context. Updates load_avg, recent_cpu and priority where
+  needed. The work is proportional to the number of ready threads,
+  not all threads: only the running thread's recent_cpu grows from
+  tick to tick, so only its priority is recomputed every 4th tick,
+  and the once-a-second decay is applied to the ready and running
+  threads at once and to blocked threads when they wake up.*/
 void thread_update_stats(int64_t ticks)
 {
+  struct thread *cur = thread_current();
+
   /*this function is only used in mlfqs mode*/
   if(!thread_mlfqs){return;}
   /*increment recent cpu of the running thread, there is no point to
     increment recent cpu of th idle thread*/
-  if(thread_current()!=idle_thread){increment_recent_cpu();}
-  /*recalculate priority of all threads every 4th tick*/
+  if(cur!=idle_thread){increment_recent_cpu();}
+  if(ticks%TIME_FREQ==0)
+    {
+      uint64_t mask;
+      int p;
+
+      load_avg=calculate_load_avg();
+      decay_history[decay_epoch % DECAY_HISTORY] = recent_cpu_decay();
+      decay_epoch++;
+
+      /*a thread that changes queues is refreshed already, so meeting
+	it again further on is harmless*/
+      mask = ready_mask;
+      for (p = PRI_MIN; p <= PRI_MAX; p++)
+	if (mask & ((uint64_t) 1 << p))
+	  {
+	    struct list_elem *e, *next;
+	    for (e = list_begin (&ready_queues[p]);
+		 e != list_end (&ready_queues[p]); e = next)
+	      {
+		next = list_next (e);
+		mlfqs_refresh (list_entry (e, struct thread, elem));
+	      }
+	  }
+      if (cur != idle_thread)
+	mlfqs_refresh (cur);
+    }
+  /*the running thread's priority drops as it uses the cpu*/
   if(ticks%TIME_SLICE==0)
     {
-      if(ticks%TIME_FREQ==0){load_avg=calculate_load_avg();}
-      struct list_elem* e;
-      struct thread* t;
-      for (e=list_begin(&all_list);e!=list_end(&all_list);e=list_next(e))
-	{
-	  t = list_entry(e,struct thread, allelem);
-	  /*recent_cpu is updated every second*/
-	  if(ticks%TIME_FREQ==0)
-	    {
-	      thread_set_t_recent_cpu(t);
-	    }
-	  t->priority = calculate_t_priority(t);
-	  
-	  
-	}
-      /*sort ready_list again with updated priority*/
-      list_sort(&ready_list,priority_compare,NULL);
+      if (cur != idle_thread)
+	thread_change_priority(cur, calculate_t_priority(cur));
       intr_yield_on_return();
     }
 }
 
-
+
 /* Idle thread.  Executes when no other thread is ready to run.
 
    The idle thread is initially put on the ready list by
@@ -653,6 +658,10 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nothing else can run until an interrupt arrives, so stop
+         the periodic tick until it is next needed. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -723,10 +732,7 @@ init_thread (struct thread *t, const char *name, int priority)
     }
   t->magic = THREAD_MAGIC;
   list_push_back (&all_list, &t->allelem);
-  /*20170765 sleeping*/
-  t->wake_up_at = INT_MAX;
   /*20170765 priority donation*/ 
-  list_init(&t->donations);
   list_init(&t->holding_locks);
 
   /* pj2 userprog*/ 
@@ -762,11 +768,74 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  int priority = ready_highest ();
+  struct thread *t;
+
+  if (priority < 0)
     return idle_thread;
-  else
-    list_sort(&ready_list,priority_compare,NULL);
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+  t = list_entry (list_front (&ready_queues[priority]), struct thread, elem);
+  ready_remove (t);
+  return t;
+}
+
+/* Appends T to the ready queue of its priority. */
+static void
+ready_push (struct thread *t)
+{
+  ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_mask |= (uint64_t) 1 << t->priority;
+  ready_threads++;
+}
+
+/* Takes T off the ready queue of its priority. */
+static void
+ready_remove (struct thread *t)
+{
+  list_remove (&t->elem);
+  ready_threads--;
+  if (list_empty (&ready_queues[t->priority]))
+    ready_mask &= ~((uint64_t) 1 << t->priority);
+}
+
+/* Returns the highest priority with a ready thread, or -1 if no
+   thread is ready. */
+static int
+ready_highest (void)
+{
+  uint32_t hi = ready_mask >> 32;
+  uint32_t lo = ready_mask;
+
+  if (hi != 0)
+    return 63 - __builtin_clz (hi);
+  if (lo != 0)
+    return 31 - __builtin_clz (lo);
+  return -1;
+}
+
+/* Sets T's priority to PRIORITY, moving T to the matching ready
+   queue if it is ready and to its new place among the waiters of
+   whatever it is waiting on. */
+void
+thread_change_priority (struct thread *t, int priority)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (t->priority != priority)
+    {
+      bool ready = t->status == THREAD_READY;
+
+      /* Keys must not change while in a queue or heap. */
+      if (ready)
+        ready_remove (t);
+      synch_unqueue (t);
+      t->priority = priority;
+      synch_requeue (t);
+      if (ready)
+        ready_push (t);
+    }
+  intr_set_level (old_level);
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -856,40 +925,13 @@ allocate_tid (void)
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
 
-/*[20170765]* A comparator for elements in sleep_list 
-  and semaphore's waiters list*/
-bool priority_compare (const struct list_elem *a, const struct list_elem *b,
-			      void *aux UNUSED)
-{
-    return list_entry (a, struct thread, elem)->priority >
-      list_entry (b, struct thread, elem)->priority;
-}
-
-bool donation_compare (const struct list_elem *a, const struct list_elem *b,
-			      void *aux UNUSED)
-{
-    return list_entry (a, struct thread, d_elem)->priority >
-      list_entry (b, struct thread, d_elem)->priority;
-}
-
-
-/*[20170765]A comparator for sleep_list,sorted by wakeup time of the threads*/
-bool sleep_compare (const struct list_elem *a, const struct list_elem *b,
-                                   void *aux UNUSED)
-{
-  return list_entry (a, struct thread,sleepelem)->wake_up_at
-    > list_entry (b, struct thread, sleepelem)->wake_up_at;
-}
-
 /*[20170765] Preempt the current thread if it no longer has higher 
   priority then all ready thread*/
 void check_preempt_current(void)
 {
-  /*no need to preempt if ready list is empty*/
-  if(list_empty(&ready_list)){return;}
-  struct thread* t = list_entry(list_begin(&ready_list),struct thread,elem);
-  if (t->priority
-	   > thread_current()->priority)
+  /*no need to preempt if no thread is ready*/
+  int priority = ready_highest ();
+  if (priority > thread_current()->priority)
     {
       if(intr_context()){intr_yield_on_return();}
       else {thread_yield();}
@@ -897,44 +939,58 @@ void check_preempt_current(void)
     }
 }
 
-/*[20170765] Donate priority to thread t, who is the holder of a lock acquired
-  This function is recursive in order to support nested donation. It is called
-  by a thread waiting on a lock held by t to donate its priority to t, if t is 
-  also waiting on a lock, this function will update for the holder of the lock
-  that t is waiting on.
+/*[20170765] Recompute the priority of thread t as the highest of its
+  base priority and the priorities of the threads waiting on the locks
+  it holds.  Each lock keeps its waiters in a heap, so this takes one
+  look per lock t holds.  A writer waiting for the readers of an
+  rwlock t holds for reading to leave donates too.  If t's priority
+  changes and t is waiting on a lock itself, the holder of that lock
+  is updated in turn, which supports nested donation; if t is such
+  a writer, so is every reader.
 */ 
 void donate_priority(struct thread* t)
 {
+  enum intr_level old_level;
+
   /*no priority donation in a 4.4BSD scheduler*/
   if(thread_mlfqs){return;}
-  /*this function is called by lock_acquire, and should be called with
-    interrupts off*/
-  ASSERT(!intr_context());
-  /*t has to be a holder of a lock*/
-  ASSERT(&t->holding_locks);
-
-  /*Set the thread's priority to the highest of the donated 
-    and its base priority*/
-  if(!list_empty(&t->donations))
-    {
-      list_sort(&t->donations, donation_compare,NULL);
-      struct thread* donator = list_entry(list_front(&t->donations),
-					  struct thread, d_elem);
-      if (donator->priority > t->base_priority){
-	t->priority = donator->priority; 
-      }
-    }
-  else
-    {
-      t->priority = t->base_priority;
-    }
 
-  /*if t is waiting on a lock too, update the holder's priority*/
-  if(t->wait_on_lock)
+  old_level = intr_disable();
+  while (t != NULL)
     {
-      donate_priority(t->wait_on_lock->holder);
+      struct lock *waiting = t->wait_on_lock;
+      int priority = t->base_priority;
+      struct list_elem *e;
+      int i;
+
+      for (e = list_begin (&t->holding_locks);
+	   e != list_end (&t->holding_locks); e = list_next (e))
+	{
+	  struct lock *l = list_entry (e, struct lock, elem);
+	  if (!heap_empty (&l->waiters))
+	    {
+	      struct thread *donator = heap_entry (heap_top (&l->waiters),
+						   struct thread, d_elem);
+	      if (donator->priority > priority)
+		priority = donator->priority;
+	    }
+	}
+      for (i = 0; i < RWLOCK_HOLDS; i++)
+	{
+	  struct rwlock *rw = t->reading[i].rw;
+	  if (rw != NULL && rw->draining
+	      && rw->writer.holder->priority > priority)
+	    priority = rw->writer.holder->priority;
+	}
+      if (priority == t->priority)
+	break;
+
+      thread_change_priority (t, priority);
+      if (t->wait_on_rwlock != NULL)
+	for (e = list_begin (&t->wait_on_rwlock->holders);
+	     e != list_end (&t->wait_on_rwlock->holders); e = list_next (e))
+	  donate_priority (list_entry (e, struct rwlock_hold, elem)->thread);
+      t = waiting != NULL ? waiting->holder : NULL;
     }
-  /*ready_list may be updated*/
-  if(t->status == THREAD_READY){list_sort(&ready_list,priority_compare,NULL);}
-  
+  intr_set_level(old_level);
 }
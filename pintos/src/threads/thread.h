@@ -2,6 +2,7 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <heap.h>
 #include <list.h>
 #include <stdint.h>
 #include "threads/synch.h"
@@ -27,6 +28,10 @@ typedef int f_p;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* [20170765] maximum and minimum of nice value that a thread can have*/
+#define NICE_MAX 20
+#define NICE_MIN -20
+
 /* time slicing */
 #define TIME_SLICE 4
 #define TIME_FREQ 100
@@ -80,12 +85,9 @@ typedef int f_p;
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
    value, triggering the assertion. */
-/* The `elem' member has a dual purpose.  It can be an element in
-   the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
-   ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+/* The `elem' member is an element in the run queue (thread.c).
+   A thread blocked on a semaphore waits in the semaphore's heap of
+   waiters (synch.c) through `sema_elem' instead. */
 struct thread
   {
     /* Owned by thread.c. */
@@ -99,21 +101,25 @@ struct thread
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
 
-   /* [20170765] To maintain sleeping threads*/
-    struct list_elem sleepelem;
-    int64_t wake_up_at; 
-    
-
     /* [20170765] priority donation */
-    struct list_elem d_elem;
-    struct list donations;
+    struct heap_elem d_elem;	/* in wait_on_lock's waiters */
     int base_priority;
     struct lock *wait_on_lock;
+    struct semaphore *wait_on_sema;	/* semaphore the thread is blocked on */
+    struct heap_elem sema_elem;	/* in wait_on_sema's waiters */
+    struct condition *wait_on_cond;	/* condition the thread waits for */
+    struct heap_elem *cond_elem;	/* its entry in wait_on_cond's waiters */
     struct list holding_locks; 
+    struct rwlock *wait_on_rwlock;	/* rwlock whose readers the thread
+					   waits to leave */
+    struct rwlock_hold reading[RWLOCK_HOLDS];	/* rwlocks held for
+						   reading */
 
      /* [20170765] 4.4BSD scheduler*/
     int nice; 		/*nice value of the thread*/
     f_p recent_cpu;	/*cpu usage of the thread, in fixed-point format*/
+    int64_t recent_cpu_epoch;	/*# of once-a-second decays applied
+				  to recent_cpu*/
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
@@ -130,6 +136,9 @@ struct thread
     
     /* filesys */ 
     struct dir* current_dir;
+    int journal_depth;		/* nesting of open journal operations */
+    size_t journal_blocks;	/* sectors they added to the running
+				   transaction */
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
@@ -169,11 +178,6 @@ tid_t thread_create (const char *name, int priority, thread_func *, void *);
 void thread_block (void);
 void thread_unblock (struct thread *);
 
-/*[20170765] Maintain sleeping threads*/
-void thread_sleep(int64_t);
-void thread_wake(int64_t);
-bool sleep_compare (const struct list_elem *a, const struct list_elem *b,
-                                   void *aux UNUSED);
 struct thread *thread_current (void);
 tid_t thread_tid (void);
 const char *thread_name (void);
@@ -190,14 +194,7 @@ int thread_get_priority (void);
 void thread_set_priority (int);
 void check_preempt_current(void);
 void donate_priority(struct thread*);
-void reset_priority(struct thread* );
-
-
-/* [20170765] Comparators */
- bool priority_compare (const struct list_elem *a, const struct list_elem *b,
-			      void *aux UNUSED);
-bool donation_compare (const struct list_elem *a, const struct list_elem *b,
-		       void *aux UNUSED);
+void thread_change_priority (struct thread *, int priority);
 
 /* [20170765]Get and modify the values used in advanced scheduler*/
 int thread_get_t_nice (struct thread*);
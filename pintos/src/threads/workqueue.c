@@ -0,0 +1,254 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of worker threads. */
+#define WORKERS 2
+
+/* Work ready to run, highest priority first.  Delayed work joins
+   it from the timer interrupt, so it is only touched with
+   interrupts off. */
+static struct heap pending;
+
+/* Upped once per piece of work in PENDING. */
+static struct semaphore pending_cnt;
+
+/* Pieces of work being run, and threads in workqueue_flush()
+   waiting for PENDING to empty and RUNNING to reach 0.  Also only
+   touched with interrupts off. */
+static int running;
+static int flushing;
+static struct semaphore flushed;    /* Upped once per flusher. */
+
+static heap_less_func work_less;
+static thread_func worker;
+static timer_func work_expire;
+static void work_push (struct work *);
+static void work_set_priority (int priority, int nice);
+static void wake_flushers (void);
+
+/* Initializes the work queue and starts its worker threads. */
+void
+workqueue_init (void)
+{
+  int i;
+
+  heap_init (&pending, work_less, NULL);
+  sema_init (&pending_cnt, 0);
+  running = 0;
+  flushing = 0;
+  sema_init (&flushed, 0);
+  for (i = 0; i < WORKERS; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "worker %d", i);
+      if (thread_create (name, PRI_DEFAULT, worker, NULL) == TID_ERROR)
+        PANIC ("can't start worker thread");
+    }
+}
+
+/* Initializes WORK to call FUNC with AUX at PRIORITY. */
+void
+work_init (struct work *work, work_func *func, void *aux, int priority)
+{
+  ASSERT (work != NULL);
+  ASSERT (func != NULL);
+  ASSERT (priority >= PRI_MIN && priority <= PRI_MAX);
+
+  work->func = func;
+  work->aux = aux;
+  work->priority = priority;
+  work->queued = false;
+  work->timer.pending = false;
+}
+
+/* Queues WORK to run as soon as a worker is free.  Returns false,
+   doing nothing, if WORK is already queued.  May be called from an
+   interrupt handler. */
+bool
+work_queue (struct work *work)
+{
+  enum intr_level old_level;
+  bool queued;
+
+  ASSERT (work != NULL);
+
+  old_level = intr_disable ();
+  queued = work->queued;
+  if (!queued)
+    {
+      work->queued = true;
+      work_push (work);
+    }
+  intr_set_level (old_level);
+  return !queued;
+}
+
+/* Queues WORK to run once TICKS timer ticks have passed.  Returns
+   false, doing nothing, if WORK is already queued. */
+bool
+work_queue_delayed (struct work *work, int64_t ticks)
+{
+  enum intr_level old_level;
+  bool queued;
+
+  ASSERT (work != NULL);
+
+  if (ticks <= 0)
+    return work_queue (work);
+
+  old_level = intr_disable ();
+  queued = work->queued;
+  if (!queued)
+    {
+      work->queued = true;
+      timer_set (&work->timer, timer_ticks () + ticks, work_expire, work);
+    }
+  intr_set_level (old_level);
+  return !queued;
+}
+
+/* Takes WORK off the queue.  Returns true if it was queued, false
+   if it was not or a worker has already started it. */
+bool
+work_cancel (struct work *work)
+{
+  enum intr_level old_level;
+  bool queued;
+
+  ASSERT (work != NULL);
+
+  old_level = intr_disable ();
+  queued = work->queued;
+  if (queued)
+    {
+      if (!timer_cancel (&work->timer))
+        {
+          /* Already pending.  Its count in PENDING_CNT stays, and
+             a worker that takes it finds nothing to do. */
+          heap_remove (&pending, &work->elem);
+          wake_flushers ();
+        }
+      work->queued = false;
+    }
+  intr_set_level (old_level);
+  return queued;
+}
+
+/* Waits until no work is pending or running, which includes work
+   queued while waiting, but not delayed work whose time has not
+   come.  Must not be called from work. */
+void
+workqueue_flush (void)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (!heap_empty (&pending) || running > 0)
+    {
+      flushing++;
+      sema_down (&flushed);
+    }
+  intr_set_level (old_level);
+}
+
+/* Wakes the threads in workqueue_flush() if there is no more work
+   to wait for.  Interrupts must be off. */
+static void
+wake_flushers (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (heap_empty (&pending) && running == 0)
+    for (; flushing > 0; flushing--)
+      sema_up (&flushed);
+}
+
+/* Moves WORK to PENDING and wakes a worker.  Interrupts must be
+   off. */
+static void
+work_push (struct work *work)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  heap_push (&pending, &work->elem);
+  sema_up (&pending_cnt);
+}
+
+/* Timer function for delayed work AUX. */
+static void
+work_expire (void *aux)
+{
+  work_push (aux);
+}
+
+/* Orders work by priority. */
+static bool
+work_less (const struct heap_elem *a, const struct heap_elem *b,
+           void *aux UNUSED)
+{
+  return heap_entry (a, struct work, elem)->priority
+    < heap_entry (b, struct work, elem)->priority;
+}
+
+/* Makes the running worker run at PRIORITY.  The MLFQS computes
+   priorities itself, so there PRIORITY adjusts the worker's own
+   NICE instead, by one for every two priority levels away from
+   PRI_DEFAULT, as in the scheduler's formula. */
+static void
+work_set_priority (int priority, int nice)
+{
+  if (thread_mlfqs)
+    {
+      nice += (PRI_DEFAULT - priority) / 2;
+      thread_set_nice (nice < NICE_MIN ? NICE_MIN
+                       : nice > NICE_MAX ? NICE_MAX : nice);
+    }
+  else
+    thread_set_priority (priority);
+}
+
+/* A worker thread.  Runs pending work, each at its own priority,
+   forever. */
+static void
+worker (void *aux UNUSED)
+{
+  int nice = thread_get_nice ();
+
+  for (;;)
+    {
+      enum intr_level old_level;
+      work_func *func = NULL;
+      void *func_aux = NULL;
+      int priority = PRI_DEFAULT;
+
+      sema_down (&pending_cnt);
+      old_level = intr_disable ();
+      if (!heap_empty (&pending))
+        {
+          struct work *work = heap_entry (heap_pop (&pending),
+                                          struct work, elem);
+          work->queued = false;
+          running++;
+          func = work->func;
+          func_aux = work->aux;
+          priority = work->priority;
+        }
+      intr_set_level (old_level);
+
+      /* The work may be queued again, or freed, from here on. */
+      if (func != NULL)
+        {
+          work_set_priority (priority, nice);
+          func (func_aux);
+          work_set_priority (PRI_DEFAULT, nice);
+          old_level = intr_disable ();
+          running--;
+          wake_flushers ();
+          intr_set_level (old_level);
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <heap.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "devices/timer.h"
+
+/* Deferred kernel work.
+
+   A piece of work is a function and an argument, run later by one
+   of a small, fixed pool of worker threads, so that background
+   jobs do not each need a thread of their own.  Work runs at its
+   own priority, higher priority work first, first come first
+   served among equals.  Under the MLFQS, which computes priorities
+   itself, the work's priority sets the worker's nice value
+   instead.  The caller owns the `struct work' and must keep it
+   alive until its function has started; the function may queue
+   its work again. */
+typedef void work_func (void *aux);
+
+struct work
+  {
+    struct heap_elem elem;      /* Element in the pending heap. */
+    struct timer timer;         /* Wakes delayed work. */
+    work_func *func;            /* Function to call. */
+    void *aux;                  /* Auxiliary data for FUNC. */
+    int priority;               /* Priority to run FUNC at. */
+    bool queued;                /* Pending or delayed. */
+  };
+
+void workqueue_init (void);
+void work_init (struct work *, work_func *, void *aux, int priority);
+bool work_queue (struct work *);
+bool work_queue_delayed (struct work *, int64_t ticks);
+bool work_cancel (struct work *);
+void workqueue_flush (void);
+
+#endif /* threads/workqueue.h */
@@ -218,7 +218,6 @@ process_exit (void)
       pagedir_destroy (pd);
     }
   /*close all files opened by the threads*/
-  file_lock_acquire();
   int i;
   for(i = 2; i<=cur->next_fd;i++)
     {
@@ -228,7 +227,6 @@ process_exit (void)
 	}
     }
   if(cur->executable){file_allow_write(cur->executable);}
-  file_lock_release();
 
   /* orphan its children, if any */
   struct list_elem *e,*removed;
@@ -373,7 +371,6 @@ load (const char *file_name, void (**eip) (void), void **esp)
   process_activate ();
 
   /* Open executable file. */
-  file_lock_acquire();
   file = filesys_open (file_name);
   if (file == NULL) 
     {
@@ -467,7 +464,6 @@ load (const char *file_name, void (**eip) (void), void **esp)
  done:
   /* We arrive here whether the load is successful or not. */
 
-  file_lock_release();
   if(!success){ file_close (file);thread_current()->executable=NULL;}
   return success;
 }
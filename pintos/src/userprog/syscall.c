@@ -13,8 +13,11 @@
 #include "filesys/file.h"
 #include "filesys/directory.h"
 #include "userprog/pagedir.h"
+#include "devices/block.h"
+#include <blockstat.h>
 static void syscall_handler (struct intr_frame *);
-static struct lock file_lock;
+/* keeps the bytes of one read from the keyboard together */
+static struct lock stdin_lock;
 
 /* Read a byte at user virtual address UADDR, which must be below PHYS_BASE.
   Returns the byte value if successful, -1 if a segfault occured */
@@ -27,16 +30,38 @@ get_user (const uint8_t *uaddr)
   return result;
 }
 
-void
-file_lock_acquire()
+/* Writes BYTE to user address UDST, which must be below PHYS_BASE.
+   Returns true if successful, false if a segfault occurred. */
+static bool
+put_user (uint8_t *udst, uint8_t byte)
 {
-  lock_acquire(&file_lock);
+  int error_code;
+  asm ("movl $1f, %0; movb %b2, %1; 1:"
+       : "=&a" (error_code), "=m" (*udst) : "q" (byte));
+  return error_code != -1;
 }
 
-void
-file_lock_release()
+/* Returns true if the SIZE bytes of user memory at UADDR can be
+   written, by writing back one byte of each page they span. */
+static bool
+check_user_writable (void* uaddr, size_t size)
 {
-  lock_release(&file_lock);
+  uint8_t *p = uaddr;
+  uint8_t *end = p + size;
+  int byte;
+
+  if (p == NULL || end < p || !is_user_vaddr (end - 1))
+    return false;
+  while (p < end)
+    {
+      if (pagedir_get_page (thread_current ()->pagedir, p) == NULL)
+        return false;
+      byte = get_user (p);
+      if (byte == -1 || !put_user (p, byte))
+        return false;
+      p = (uint8_t *) pg_round_down (p) + PGSIZE;
+    }
+  return true;
 }
 
 
@@ -136,9 +161,7 @@ sys_create(void* esp)
       thread_current()->exit_status=-1;
       thread_exit();
     }
-  //lock_acquire(&file_lock);
   bool ret = filesys_create( (char*)file, size);
-  //lock_release(&file_lock);
   return ret;
 }
 
@@ -161,7 +184,6 @@ sys_open(void* esp)
     {
       return -1;
     }
-  // lock_acquire(&file_lock);
   struct file* ret = filesys_open( (char*)file);
   if(ret) {
     thread_current()->fdt[thread_current()->next_fd++]=ret;
@@ -169,11 +191,9 @@ sys_open(void* esp)
       {
 	file_deny_write(ret);
       }
-    // lock_release(&file_lock);
     return thread_current()->next_fd-1;
   }
   else{
-    // lock_release(&file_lock);
     return -1;
   }
 }
@@ -197,9 +217,7 @@ sys_remove(void* esp)
     {
       return -1;
     }
-  //lock_acquire(&file_lock);
   ret = filesys_remove((char*)file);
-  //lock_release(&file_lock);
   return ret;
 }
 
@@ -221,9 +239,7 @@ sys_close(void* esp)
 	thread_exit();
       }
       else{
-	//lock_acquire(&file_lock);
 	file_close(file);
-	//lock_release(&file_lock);
       }
       thread_current()->fdt[fd] = NULL;
     }
@@ -252,9 +268,7 @@ sys_filesize(void* esp)
 	thread_exit();
       }
       else{
-	//lock_acquire(&file_lock);
 	size = file_length(file);
-	//lock_release(&file_lock);
       }
     }
   else
@@ -283,9 +297,7 @@ sys_tell(void* esp)
 	thread_exit();
       }
       else{
-	//lock_acquire(&file_lock);
 	pos = file_tell(file);
-	//lock_release(&file_lock);
       }
     }
   else
@@ -319,9 +331,7 @@ sys_write(void* esp)
     }
 
   if(fd==1){
-    //lock_acquire(&file_lock);
     putbuf ((const void *)buf_ptr,size);
-    //lock_release(&file_lock);
     return size;
   }
   else if(fd==0)
@@ -342,9 +352,7 @@ sys_write(void* esp)
 	thread_current()->exit_status=-1;
 	thread_exit();
       }      
-      //lock_acquire(&file_lock);
       bytes = file_write(file,(void*)buf_ptr,size);
-      //lock_release(&file_lock);
     }
   return bytes;
 }
@@ -370,13 +378,13 @@ sys_read(void* esp)
     }
 
   if(fd==0){
-    lock_acquire(&file_lock);
+    lock_acquire(&stdin_lock);
     for(bytes=0;bytes<size;bytes++)
       {
 	char* charbuf = (char*)buf_ptr;
 	charbuf[bytes]=input_getc();
       }
-    lock_release(&file_lock);
+    lock_release(&stdin_lock);
     return bytes;
   }
   else if(fd==1)
@@ -396,9 +404,7 @@ sys_read(void* esp)
 	thread_current()->exit_status=-1;
 	thread_exit();
       }      
-      // lock_acquire(&file_lock);
       bytes = file_read(file,(void*)buf_ptr,size);
-      //lock_release(&file_lock);
     }
 
   return bytes;
@@ -428,9 +434,7 @@ sys_seek(void* esp)
 	thread_current()->exit_status=-1;
 	thread_exit();
       }     
-      //lock_acquire(&file_lock);
       file_seek(file,new_pos);
-      // lock_release(&file_lock);
     }
 }
 
@@ -530,11 +534,93 @@ static int sys_inumber(void* esp){
     return false;
   return (int)inode_get_inumber(inode);
 }
+static bool sys_blockstat(void* esp){
+  int role,stats;
+  if(read_arg((esp+sizeof(int)),&role)==-1 ||
+     read_arg((esp+sizeof(int)*2),&stats)==-1)
+    {
+      thread_current()->exit_status=-1;
+      thread_exit();
+    }
+  /* the whole user buffer must be mapped writable */
+  if(!check_user_writable((void*)stats,sizeof(struct blockstat)))
+    {
+      thread_current()->exit_status=-1;
+      thread_exit();
+    }
+  if(role<0)
+    return false;
+  return block_get_stats((enum block_type)role,(struct blockstat*)stats);
+}
+/* fsync and fdatasync, DATA_ONLY tells which */
+static bool sys_fsync(void* esp, bool data_only){
+  int fd;
+  if(read_arg((esp+sizeof(int)),&fd)==-1)
+    {
+      thread_current()->exit_status=-1;
+      thread_exit();
+    }
+  if(fd < 2 || fd >= thread_current()->next_fd)
+    return false;
+  struct file* file = thread_current()->fdt[fd];
+  if(file==NULL)
+    return false;
+  file_sync(file,data_only);
+  return true;
+}
+/* reserve disk space for a range of a file */
+static bool sys_fallocate(void* esp){
+  int fd, offset, length;
+  if(read_arg((esp+sizeof(int)),&fd)==-1 ||
+     read_arg((esp+sizeof(int)*2),&offset)==-1 ||
+     read_arg((esp+sizeof(int)*3),&length)==-1)
+    {
+      thread_current()->exit_status=-1;
+      thread_exit();
+    }
+  if(fd < 2 || fd >= thread_current()->next_fd)
+    return false;
+  struct file* file = thread_current()->fdt[fd];
+  if(file==NULL)
+    return false;
+  return file_allocate(file,offset,length);
+}
+/* change the length of a file */
+static bool sys_ftruncate(void* esp){
+  int fd, length;
+  if(read_arg((esp+sizeof(int)),&fd)==-1 ||
+     read_arg((esp+sizeof(int)*2),&length)==-1)
+    {
+      thread_current()->exit_status=-1;
+      thread_exit();
+    }
+  if(fd < 2 || fd >= thread_current()->next_fd)
+    return false;
+  struct file* file = thread_current()->fdt[fd];
+  if(file==NULL)
+    return false;
+  return file_truncate(file,length);
+}
+/* move a file's blocks into consecutive sectors */
+static bool sys_defrag(void* esp){
+  int fd;
+  if(read_arg((esp+sizeof(int)),&fd)==-1)
+    {
+      thread_current()->exit_status=-1;
+      thread_exit();
+    }
+  if(fd < 2 || fd >= thread_current()->next_fd)
+    return false;
+  struct file* file = thread_current()->fdt[fd];
+  if(file==NULL)
+    return false;
+  return file_defrag(file);
+}
 void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&file_lock);
+  lock_init(&stdin_lock);
 }
 
 static void
@@ -546,7 +632,7 @@ syscall_handler (struct intr_frame *f UNUSED)
   /*validate syscall number*/
   else
     {
-      if(syscall_num<1||syscall_num>19){f->eax=-1;}
+      if(syscall_num<1||syscall_num>=SYS_CNT){f->eax=-1;}
       else
   	{
   	  switch(syscall_num)
@@ -606,6 +692,24 @@ syscall_handler (struct intr_frame *f UNUSED)
 	    case SYS_INUMBER:
 	      f->eax = sys_inumber(f->esp);
 	      break;
+	    case SYS_BLOCKSTAT:
+	      f->eax = sys_blockstat(f->esp);
+	      break;
+	    case SYS_FSYNC:
+	      f->eax = sys_fsync(f->esp,false);
+	      break;
+	    case SYS_FDATASYNC:
+	      f->eax = sys_fsync(f->esp,true);
+	      break;
+	    case SYS_FALLOCATE:
+	      f->eax = sys_fallocate(f->esp);
+	      break;
+	    case SYS_FTRUNCATE:
+	      f->eax = sys_ftruncate(f->esp);
+	      break;
+	    case SYS_DEFRAG:
+	      f->eax = sys_defrag(f->esp);
+	      break;
   	    }
   	}
     }
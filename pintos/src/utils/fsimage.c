@@ -0,0 +1,1167 @@
+/* fsimage: builds, inspects and checks Pintos file system images
+   on the host, without booting Pintos.
+
+   An image is either a raw file system partition, as used with
+   `pintos --filesys=FILE', or a partitioned disk such as the
+   filesys.dsk that pintos-mkdisk builds, in which case its file
+   system partition is used.  The whole partition is read into
+   memory, so building or checking even a large tree costs one
+   read and one write of the image.
+
+   The on-disk structures below mirror filesys/inode.h,
+   filesys/directory.c and filesys/journal.c and must be kept in
+   sync with them.  Like Pintos itself, this assumes a
+   little-endian machine. */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DIV_ROUND_UP(X, STEP) (((X) + (STEP) - 1) / (STEP))
+
+/* Sector size and the sectors of the system files
+   (filesys/filesys.h). */
+#define SECTOR_SIZE 512
+#define FREE_MAP_SECTOR 0
+#define ROOT_DIR_SECTOR 1
+#define JOURNAL_SECTOR 2
+
+/* Inodes (filesys/inode.h).  Block map entries of 0 are holes. */
+#define INODE_MAGIC 0x494e4f44
+#define DIRECT_BLOCK_ENTRIES 121
+#define INDIRECT_BLOCK_ENTRIES 128
+#define BLOCK_MAP_LEVELS 3
+#define INODE_INLINE_SIZE ((DIRECT_BLOCK_ENTRIES + BLOCK_MAP_LEVELS) * 4)
+#define INODE_INLINE 0x1
+#define MAX_FILE_SIZE ((DIRECT_BLOCK_ENTRIES + INDIRECT_BLOCK_ENTRIES    \
+                        + INDIRECT_BLOCK_ENTRIES * INDIRECT_BLOCK_ENTRIES \
+                        + INDIRECT_BLOCK_ENTRIES * INDIRECT_BLOCK_ENTRIES \
+                          * INDIRECT_BLOCK_ENTRIES)                       \
+                       * (int64_t) SECTOR_SIZE)
+
+struct inode_disk
+  {
+    uint32_t self_sector;
+    uint32_t magic;
+    int32_t length;
+    uint16_t is_dir;
+    uint16_t flags;
+    union
+      {
+        struct
+          {
+            uint32_t direct[DIRECT_BLOCK_ENTRIES];
+            uint32_t roots[BLOCK_MAP_LEVELS]; /* Indirect, doubly and
+                                                 triply indirect. */
+          }
+        map;
+        uint8_t inline_data[INODE_INLINE_SIZE];
+      };
+  };
+
+/* Directories (filesys/directory.c).  dir_create() makes room for
+   16 entries besides "." and "..". */
+#define FS_NAME_MAX 14
+#define DIR_ENTRIES 16
+
+struct dir_entry
+  {
+    uint32_t inode_sector;
+    char name[FS_NAME_MAX + 1];
+    uint8_t in_use;
+  };
+
+/* Journal (filesys/journal.c).  Only the fields used here. */
+#define JOURNAL_SUPER_MAGIC 0x4a524e4c
+#define JOURNAL_DESC_MAGIC 0x4a444553
+#define JOURNAL_COMMIT_MAGIC 0x4a434d54
+#define JOURNAL_MAX_BLOCKS 125
+#define JOURNAL_LOG_SECTORS (JOURNAL_MAX_BLOCKS + 2)
+
+struct journal_super
+  {
+    uint32_t magic;
+    uint32_t log_start;
+    uint32_t log_size;
+    uint32_t seq;
+  };
+
+struct journal_desc
+  {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t cnt;
+    uint32_t sectors[JOURNAL_MAX_BLOCKS];
+  };
+
+struct journal_commit
+  {
+    uint32_t magic;
+    uint32_t seq;
+  };
+
+/* Block groups (filesys/free-map.h). */
+#define GROUP_SECTORS 1024
+
+/* Partition type pintos-mkdisk gives the file system. */
+#define FILESYS_PART_TYPE 0x21
+
+static const char *program_name;
+static const char *image_name;
+static uint8_t *image;                  /* The file system partition. */
+static uint32_t sector_cnt;             /* Its size in sectors. */
+static off_t image_ofs;                 /* Its offset in IMAGE_NAME. */
+static uint8_t *free_map;               /* One bit per sector, laid out
+                                           as bitmap_write() stores it. */
+static size_t free_map_bytes;           /* Size of the free map file. */
+
+static void
+fatal (const char *format, ...)
+{
+  va_list args;
+
+  fprintf (stderr, "%s: ", program_name);
+  va_start (args, format);
+  vfprintf (stderr, format, args);
+  va_end (args);
+  putc ('\n', stderr);
+  exit (2);
+}
+
+static void *
+xcalloc (size_t cnt, size_t size)
+{
+  void *p = calloc (cnt, size);
+  if (p == NULL && cnt * size != 0)
+    fatal ("out of memory");
+  return p;
+}
+
+static bool
+bit_test (const uint8_t *map, uint32_t i)
+{
+  return (map[i / 8] >> (i % 8)) & 1;
+}
+
+static void
+bit_set (uint8_t *map, uint32_t i, bool value)
+{
+  if (value)
+    map[i / 8] |= 1 << (i % 8);
+  else
+    map[i / 8] &= ~(1 << (i % 8));
+}
+
+/* Returns sector S of the partition. */
+static void *
+sector (uint32_t s)
+{
+  if (s >= sector_cnt)
+    fatal ("sector %u is past the end of %s", s, image_name);
+  return image + (size_t) s * SECTOR_SIZE;
+}
+
+/* Image files. */
+
+static void
+read_fully (int fd, void *buf, size_t size, off_t ofs)
+{
+  while (size > 0)
+    {
+      ssize_t n = pread (fd, buf, size, ofs);
+      if (n <= 0)
+        fatal ("%s: read failed: %s", image_name,
+               n < 0 ? strerror (errno) : "unexpected end of file");
+      buf = (uint8_t *) buf + n;
+      size -= n;
+      ofs += n;
+    }
+}
+
+static void
+write_fully (int fd, const void *buf, size_t size, off_t ofs)
+{
+  while (size > 0)
+    {
+      ssize_t n = pwrite (fd, buf, size, ofs);
+      if (n <= 0)
+        fatal ("%s: write failed: %s", image_name, strerror (errno));
+      buf = (const uint8_t *) buf + n;
+      size -= n;
+      ofs += n;
+    }
+}
+
+/* Sets up an empty in-memory partition of CNT sectors. */
+static void
+new_image (uint32_t cnt)
+{
+  if (cnt <= JOURNAL_SECTOR + JOURNAL_LOG_SECTORS)
+    fatal ("%s: too small for a file system", image_name);
+  sector_cnt = cnt;
+  image_ofs = 0;
+  image = xcalloc (cnt, SECTOR_SIZE);
+  free_map_bytes = 4 * DIV_ROUND_UP (cnt, 32);
+  free_map = xcalloc (1, free_map_bytes);
+}
+
+/* Reads the file system partition of IMAGE_NAME into memory.  A
+   partitioned disk is told apart from a raw partition by the MBR
+   signature and a partition of type FILESYS_PART_TYPE. */
+static void
+load_image (void)
+{
+  uint8_t mbr[SECTOR_SIZE];
+  struct stat st;
+  off_t ofs = 0, size;
+  int fd, i;
+
+  fd = open (image_name, O_RDONLY);
+  if (fd < 0 || fstat (fd, &st) < 0)
+    fatal ("%s: %s", image_name, strerror (errno));
+  size = st.st_size;
+  if (size < SECTOR_SIZE)
+    fatal ("%s: too small for a file system", image_name);
+  read_fully (fd, mbr, sizeof mbr, 0);
+  if (mbr[510] == 0x55 && mbr[511] == 0xaa)
+    for (i = 0; i < 4; i++)
+      {
+        const uint8_t *p = mbr + 446 + 16 * i;
+        uint32_t start, cnt;
+
+        if (p[4] != FILESYS_PART_TYPE)
+          continue;
+        memcpy (&start, p + 8, 4);
+        memcpy (&cnt, p + 12, 4);
+        ofs = (off_t) start * SECTOR_SIZE;
+        size = (off_t) cnt * SECTOR_SIZE;
+        break;
+      }
+
+  new_image (size / SECTOR_SIZE);
+  image_ofs = ofs;
+  read_fully (fd, image, (size_t) sector_cnt * SECTOR_SIZE, image_ofs);
+  close (fd);
+}
+
+/* Writes the in-memory partition back to IMAGE_NAME, creating it
+   if CREATE. */
+static void
+save_image (bool create)
+{
+  int fd = open (image_name, create ? O_WRONLY | O_CREAT | O_TRUNC : O_WRONLY,
+                 0666);
+  if (fd < 0)
+    fatal ("%s: %s", image_name, strerror (errno));
+  write_fully (fd, image, (size_t) sector_cnt * SECTOR_SIZE, image_ofs);
+  if (close (fd) < 0)
+    fatal ("%s: %s", image_name, strerror (errno));
+}
+
+/* Allocation, as free_map_allocate_near() does it. */
+
+/* Allocates CNT consecutive free sectors, the first run at or
+   after GOAL or else the first one on the disk, and returns the
+   first of them, or 0 if there is no such run. */
+static uint32_t
+allocate (uint32_t cnt, uint32_t goal)
+{
+  uint32_t start, run, i;
+  int pass;
+
+  if (goal >= sector_cnt)
+    goal = 0;
+  for (pass = 0; pass < 2; pass++)
+    for (start = pass ? 0 : goal, run = 0, i = start; i < sector_cnt; i++)
+      {
+        if (bit_test (free_map, i))
+          {
+            run = 0;
+            start = i + 1;
+            continue;
+          }
+        if (++run == cnt)
+          {
+            for (i = start; i < start + cnt; i++)
+              bit_set (free_map, i, true);
+            memset (sector (start), 0, (size_t) cnt * SECTOR_SIZE);
+            return start;
+          }
+      }
+  return 0;
+}
+
+/* Returns the first sector of the group with the most free
+   sectors, where new directories go. */
+static uint32_t
+spread_goal (void)
+{
+  uint32_t best = 0, best_free = 0, start, i;
+
+  for (start = 0; start < sector_cnt; start += GROUP_SECTORS)
+    {
+      uint32_t group_free = 0;
+      for (i = start; i < sector_cnt && i < start + GROUP_SECTORS; i++)
+        group_free += !bit_test (free_map, i);
+      if (group_free > best_free)
+        {
+          best = start;
+          best_free = group_free;
+        }
+    }
+  return best;
+}
+
+/* Block maps. */
+
+/* Returns the slot of INODE's block map that holds block IDX, or
+   a null pointer if IDX is past the largest file or, unless
+   CREATE, if a pointer block on the way is missing or invalid.
+   With CREATE, missing pointer blocks are allocated near the
+   inode. */
+static uint32_t *
+map_slot (struct inode_disk *inode, size_t idx, bool create)
+{
+  uint32_t *slot;
+  size_t span = 1;
+  int levels, l;
+
+  if (idx < DIRECT_BLOCK_ENTRIES)
+    return &inode->map.direct[idx];
+  idx -= DIRECT_BLOCK_ENTRIES;
+  for (levels = 1; levels <= BLOCK_MAP_LEVELS; levels++)
+    {
+      span *= INDIRECT_BLOCK_ENTRIES;
+      if (idx < span)
+        break;
+      idx -= span;
+    }
+  if (levels > BLOCK_MAP_LEVELS)
+    return NULL;
+
+  slot = &inode->map.roots[levels - 1];
+  for (l = 0; l < levels; l++)
+    {
+      span /= INDIRECT_BLOCK_ENTRIES;
+      if (*slot == 0 && create
+          && (*slot = allocate (1, inode->self_sector + 1)) == 0)
+        fatal ("%s: file system full", image_name);
+      if (*slot == 0 || *slot >= sector_cnt)
+        return NULL;
+      slot = (uint32_t *) sector (*slot) + idx / span;
+      idx %= span;
+    }
+  return slot;
+}
+
+/* Copies SIZE bytes at OFS of the file with INODE into BUF, or
+   from BUF into the file if WRITE.  Holes read as zeros and are
+   left alone by writes. */
+static void
+file_io (struct inode_disk *inode, void *buf_, size_t size, size_t ofs,
+         bool write)
+{
+  uint8_t *buf = buf_;
+
+  if (inode->flags & INODE_INLINE)
+    {
+      if (ofs + size > INODE_INLINE_SIZE)
+        fatal ("inode %u: inline access past the inode", inode->self_sector);
+      if (write)
+        memcpy (inode->inline_data + ofs, buf, size);
+      else
+        memcpy (buf, inode->inline_data + ofs, size);
+      return;
+    }
+  while (size > 0)
+    {
+      size_t sector_ofs = ofs % SECTOR_SIZE;
+      size_t chunk = SECTOR_SIZE - sector_ofs < size
+                     ? SECTOR_SIZE - sector_ofs : size;
+      uint32_t *slot = map_slot (inode, ofs / SECTOR_SIZE, false);
+      bool mapped = slot != NULL && *slot != 0 && *slot < sector_cnt;
+
+      if (write && mapped)
+        memcpy ((uint8_t *) sector (*slot) + sector_ofs, buf, chunk);
+      else if (!write)
+        {
+          if (mapped)
+            memcpy (buf, (uint8_t *) sector (*slot) + sector_ofs, chunk);
+          else
+            memset (buf, 0, chunk);
+        }
+      buf += chunk;
+      ofs += chunk;
+      size -= chunk;
+    }
+}
+
+/* Returns the inode at sector S, or a null pointer if S does not
+   hold one. */
+static struct inode_disk *
+get_inode (uint32_t s)
+{
+  struct inode_disk *inode;
+
+  if (s >= sector_cnt)
+    return NULL;
+  inode = sector (s);
+  return inode->magic == INODE_MAGIC ? inode : NULL;
+}
+
+/* Reads the whole file with INODE into a new buffer. */
+static void *
+read_file (struct inode_disk *inode)
+{
+  void *data = xcalloc (1, inode->length + 1);
+  file_io (inode, data, inode->length, 0, false);
+  return data;
+}
+
+/* Journal. */
+
+/* Replays the committed but not checkpointed transaction in the
+   log, if any, as journal_open() would at the next boot.  Returns
+   the number of sectors replayed. */
+static uint32_t
+replay_journal (void)
+{
+  struct journal_super *super = sector (JOURNAL_SECTOR);
+  struct journal_desc *desc;
+  struct journal_commit *commit;
+  uint32_t i;
+
+  if (super->magic != JOURNAL_SUPER_MAGIC
+      || super->log_size < JOURNAL_LOG_SECTORS
+      || super->log_start >= sector_cnt
+      || super->log_size > sector_cnt - super->log_start)
+    return 0;
+  desc = sector (super->log_start);
+  if (desc->magic != JOURNAL_DESC_MAGIC || desc->seq <= super->seq
+      || desc->cnt > JOURNAL_MAX_BLOCKS)
+    return 0;
+  commit = sector (super->log_start + 1 + desc->cnt);
+  super->seq = desc->seq;
+  if (commit->magic != JOURNAL_COMMIT_MAGIC || commit->seq != desc->seq)
+    return 0;
+  for (i = 0; i < desc->cnt; i++)
+    if (desc->sectors[i] < sector_cnt)
+      memcpy (sector (desc->sectors[i]), sector (super->log_start + 1 + i),
+              SECTOR_SIZE);
+  return desc->cnt;
+}
+
+/* Making file systems. */
+
+/* Makes sector S an inode for the SIZE bytes of DATA, laid out as
+   inode_create() and inode_write_at() would leave them: inline if
+   they fit, or else in runs of sectors following the inode.  Blocks
+   of zeros become holes unless DENSE. */
+static void
+make_inode (uint32_t s, const void *data_, size_t size, bool is_dir,
+            bool dense)
+{
+  const uint8_t *data = data_;
+  struct inode_disk *inode = sector (s);
+  size_t blocks = DIV_ROUND_UP (size, SECTOR_SIZE);
+  size_t i, k, run;
+  uint32_t start;
+
+  if ((int64_t) size > MAX_FILE_SIZE)
+    fatal ("file of %zu bytes is too large", size);
+  memset (inode, 0, SECTOR_SIZE);
+  inode->self_sector = s;
+  inode->magic = INODE_MAGIC;
+  inode->length = size;
+  inode->is_dir = is_dir;
+  if (size <= INODE_INLINE_SIZE)
+    {
+      inode->flags = INODE_INLINE;
+      memcpy (inode->inline_data, data, size);
+      return;
+    }
+
+  for (i = 0; i < blocks; i += run)
+    {
+      static const uint8_t zeros[SECTOR_SIZE];
+      uint32_t *prev = i > 0 ? map_slot (inode, i - 1, false) : NULL;
+      uint32_t goal = (prev != NULL && *prev != 0 ? *prev : s) + 1;
+
+      /* the next run of blocks that are not holes */
+      for (run = 0; i + run < blocks; run++)
+        {
+          size_t len = size - (i + run) * SECTOR_SIZE;
+          if (!dense && !memcmp (data + (i + run) * SECTOR_SIZE, zeros,
+                                 len < SECTOR_SIZE ? len : SECTOR_SIZE))
+            break;
+        }
+      if (run == 0)
+        {
+          run = 1;
+          continue;
+        }
+
+      while ((start = allocate (run, goal)) == 0)
+        if ((run /= 2) == 0)
+          fatal ("%s: file system full", image_name);
+      for (k = 0; k < run; k++)
+        {
+          size_t len = size - (i + k) * SECTOR_SIZE;
+          uint32_t *slot = map_slot (inode, i + k, true);
+          *slot = start + k;
+          memcpy (sector (start + k), data + (i + k) * SECTOR_SIZE,
+                  len < SECTOR_SIZE ? len : SECTOR_SIZE);
+        }
+    }
+}
+
+/* Copies host directory PATH, and everything under it, into the
+   directory with inode sector S, whose parent is PARENT.  The
+   directory is written the way dir_create() and dir_add() would
+   write it. */
+static void
+import_dir (const char *path, uint32_t s, uint32_t parent)
+{
+  struct dirent **names;
+  struct dir_entry *entries;
+  size_t slots, cnt = 0;
+  int n, i;
+
+  n = scandir (path, &names, NULL, alphasort);
+  if (n < 0)
+    fatal ("%s: %s", path, strerror (errno));
+  slots = (size_t) n + 2 > DIR_ENTRIES + 2 ? (size_t) n + 2 : DIR_ENTRIES + 2;
+  entries = xcalloc (slots, sizeof *entries);
+
+  /* dir_create() points "." at the parent and ".." at the
+     directory itself */
+  entries[cnt].inode_sector = parent;
+  strcpy (entries[cnt].name, ".");
+  entries[cnt++].in_use = true;
+  entries[cnt].inode_sector = s;
+  strcpy (entries[cnt].name, "..");
+  entries[cnt++].in_use = true;
+
+  for (i = 0; i < n; i++)
+    {
+      const char *name = names[i]->d_name;
+      char *child_path;
+      struct stat st;
+      uint32_t child;
+
+      if (!strcmp (name, ".") || !strcmp (name, ".."))
+        goto next;
+      if (strlen (name) > FS_NAME_MAX)
+        {
+          fprintf (stderr, "%s: %s/%s: name too long, skipped\n",
+                   program_name, path, name);
+          goto next;
+        }
+      child_path = xcalloc (1, strlen (path) + strlen (name) + 2);
+      sprintf (child_path, "%s/%s", path, name);
+      if (stat (child_path, &st) < 0)
+        fatal ("%s: %s", child_path, strerror (errno));
+
+      if (S_ISDIR (st.st_mode))
+        {
+          if ((child = allocate (1, spread_goal ())) == 0)
+            fatal ("%s: file system full", image_name);
+          import_dir (child_path, child, s);
+        }
+      else if (S_ISREG (st.st_mode))
+        {
+          uint8_t *data = xcalloc (1, st.st_size + 1);
+          int fd = open (child_path, O_RDONLY);
+
+          if (fd < 0)
+            fatal ("%s: %s", child_path, strerror (errno));
+          read_fully (fd, data, st.st_size, 0);
+          close (fd);
+          /* a file's inode goes in its directory's group */
+          if ((child = allocate (1, s)) == 0)
+            fatal ("%s: file system full", image_name);
+          make_inode (child, data, st.st_size, false, false);
+          free (data);
+        }
+      else
+        {
+          fprintf (stderr, "%s: %s: not a regular file, skipped\n",
+                   program_name, child_path);
+          free (child_path);
+          goto next;
+        }
+
+      entries[cnt].inode_sector = child;
+      strcpy (entries[cnt].name, name);
+      entries[cnt++].in_use = true;
+      free (child_path);
+    next:
+      free (names[i]);
+    }
+  free (names);
+
+  make_inode (s, entries, slots * sizeof *entries, true, true);
+  free (entries);
+}
+
+/* Formats a file system of SIZE_MB megabytes, as do_format() does,
+   and fills it from host directory DIR if not null. */
+static int
+do_mkfs (double size_mb, const char *dir)
+{
+  struct journal_super *super;
+  uint32_t log_start;
+
+  if (!(size_mb > 0))
+    fatal ("%g: not a valid size in MB", size_mb);
+  new_image ((uint32_t) (size_mb * 1024 * 1024 / SECTOR_SIZE));
+  bit_set (free_map, FREE_MAP_SECTOR, true);
+  bit_set (free_map, ROOT_DIR_SECTOR, true);
+  bit_set (free_map, JOURNAL_SECTOR, true);
+
+  /* the free map file gets all its blocks now; its contents are
+     written last */
+  make_inode (FREE_MAP_SECTOR, free_map, free_map_bytes, false, true);
+
+  if ((log_start = allocate (JOURNAL_LOG_SECTORS, 0)) == 0)
+    fatal ("%s: no room for the journal", image_name);
+  super = sector (JOURNAL_SECTOR);
+  super->magic = JOURNAL_SUPER_MAGIC;
+  super->log_start = log_start;
+  super->log_size = JOURNAL_LOG_SECTORS;
+  super->seq = 0;
+
+  if (dir != NULL)
+    import_dir (dir, ROOT_DIR_SECTOR, ROOT_DIR_SECTOR);
+  else
+    {
+      struct dir_entry entries[DIR_ENTRIES + 2];
+      memset (entries, 0, sizeof entries);
+      entries[0].inode_sector = ROOT_DIR_SECTOR;
+      strcpy (entries[0].name, ".");
+      entries[0].in_use = true;
+      entries[1].inode_sector = ROOT_DIR_SECTOR;
+      strcpy (entries[1].name, "..");
+      entries[1].in_use = true;
+      make_inode (ROOT_DIR_SECTOR, entries, sizeof entries, true, true);
+    }
+
+  file_io (sector (FREE_MAP_SECTOR), free_map, free_map_bytes, 0, true);
+  save_image (true);
+  return 0;
+}
+
+/* Inspection. */
+
+/* Reads the free map file into FREE_MAP. */
+static void
+read_free_map (void)
+{
+  struct inode_disk *inode = get_inode (FREE_MAP_SECTOR);
+  if (inode == NULL)
+    fatal ("%s: no free map inode", image_name);
+  file_io (inode, free_map, free_map_bytes, 0, false);
+}
+
+static int
+do_info (void)
+{
+  struct journal_super *super;
+  uint32_t free_cnt = 0, i, start;
+  uint32_t replayed;
+
+  load_image ();
+  replayed = replay_journal ();
+  read_free_map ();
+  for (i = 0; i < sector_cnt; i++)
+    free_cnt += !bit_test (free_map, i);
+  printf ("%u sectors (%u kB), %u free\n",
+          sector_cnt, sector_cnt / 2, free_cnt);
+
+  super = sector (JOURNAL_SECTOR);
+  if (super->magic == JOURNAL_SUPER_MAGIC)
+    printf ("journal: sectors %u-%u, last checkpointed transaction %u\n",
+            super->log_start, super->log_start + super->log_size - 1,
+            super->seq);
+  else
+    printf ("journal: none\n");
+  if (replayed)
+    printf ("journal: %u sectors of a committed transaction "
+            "not yet checkpointed (shown replayed)\n", replayed);
+
+  for (start = 0; start < sector_cnt; start += GROUP_SECTORS)
+    {
+      uint32_t end = start + GROUP_SECTORS < sector_cnt
+                     ? start + GROUP_SECTORS : sector_cnt;
+      uint32_t group_free = 0;
+      for (i = start; i < end; i++)
+        group_free += !bit_test (free_map, i);
+      printf ("group %u: sectors %u-%u, %u free\n",
+              start / GROUP_SECTORS, start, end - 1, group_free);
+    }
+  return 0;
+}
+
+/* Prints the tree under the directory with INODE, whose path is
+   PATH.  SEEN keeps loops from being followed. */
+static void
+list_dir (struct inode_disk *inode, const char *path, uint8_t *seen)
+{
+  struct dir_entry *entries = read_file (inode);
+  size_t cnt = inode->length / sizeof *entries;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct dir_entry *e = &entries[i];
+      struct inode_disk *child;
+      char name[FS_NAME_MAX + 1];
+      char *child_path;
+
+      if (!e->in_use)
+        continue;
+      memcpy (name, e->name, FS_NAME_MAX);
+      name[FS_NAME_MAX] = '\0';
+      if (!strcmp (name, ".") || !strcmp (name, ".."))
+        continue;
+      child_path = xcalloc (1, strlen (path) + strlen (name) + 2);
+      sprintf (child_path, "%s/%s", path, name);
+      child = get_inode (e->inode_sector);
+      if (child == NULL)
+        printf ("%10s %7u %s (bad inode)\n", "?", e->inode_sector,
+                child_path);
+      else
+        {
+          printf ("%10d %7u %s%s%s\n", child->length, e->inode_sector,
+                  child_path, child->is_dir ? "/" : "",
+                  child->flags & INODE_INLINE ? " (inline)" : "");
+          if (child->is_dir && !bit_test (seen, e->inode_sector))
+            {
+              bit_set (seen, e->inode_sector, true);
+              list_dir (child, child_path, seen);
+            }
+        }
+      free (child_path);
+    }
+  free (entries);
+}
+
+static int
+do_ls (void)
+{
+  struct inode_disk *root;
+  uint8_t *seen;
+
+  load_image ();
+  replay_journal ();
+  if ((root = get_inode (ROOT_DIR_SECTOR)) == NULL)
+    fatal ("%s: no root directory", image_name);
+  seen = xcalloc (1, free_map_bytes);
+  bit_set (seen, ROOT_DIR_SECTOR, true);
+  printf ("%10s %7s %s\n", "size", "inode", "path");
+  list_dir (root, "", seen);
+  free (seen);
+  return 0;
+}
+
+/* Returns the inode of the entry named NAME in directory DIR, or
+   a null pointer if there is none. */
+static struct inode_disk *
+dir_lookup (struct inode_disk *dir, const char *name)
+{
+  struct dir_entry *entries = read_file (dir);
+  size_t cnt = dir->length / sizeof *entries;
+  struct inode_disk *inode = NULL;
+  size_t i;
+
+  for (i = 0; i < cnt && inode == NULL; i++)
+    if (entries[i].in_use && !strncmp (entries[i].name, name, FS_NAME_MAX + 1))
+      inode = get_inode (entries[i].inode_sector);
+  free (entries);
+  return inode;
+}
+
+static int
+do_cat (const char *path)
+{
+  struct inode_disk *inode;
+  char *copy, *name, *save;
+  void *data;
+
+  load_image ();
+  replay_journal ();
+  if ((inode = get_inode (ROOT_DIR_SECTOR)) == NULL)
+    fatal ("%s: no root directory", image_name);
+  copy = strdup (path);
+  for (name = strtok_r (copy, "/", &save); name != NULL;
+       name = strtok_r (NULL, "/", &save))
+    if (!inode->is_dir || (inode = dir_lookup (inode, name)) == NULL)
+      fatal ("%s: not found", path);
+  free (copy);
+  if (inode->is_dir)
+    fatal ("%s: is a directory", path);
+
+  data = read_file (inode);
+  if (fwrite (data, 1, inode->length, stdout) != (size_t) inode->length)
+    fatal ("write error: %s", strerror (errno));
+  free (data);
+  return 0;
+}
+
+/* Checking. */
+
+static uint8_t *used;                   /* Sectors found in use. */
+static uint8_t *seen;                   /* Inodes found in the tree. */
+static unsigned problem_cnt;
+
+static void
+problem (const char *format, ...)
+{
+  va_list args;
+
+  va_start (args, format);
+  vprintf (format, args);
+  va_end (args);
+  putchar ('\n');
+  problem_cnt++;
+}
+
+/* Marks sector S used by INODE as WHAT.  Returns false if S is not
+   a valid sector. */
+static bool
+claim (uint32_t s, uint32_t inode, const char *what)
+{
+  if (s >= sector_cnt)
+    {
+      problem ("inode %u: %s %u is past the end of the disk",
+               inode, what, s);
+      return false;
+    }
+  if (bit_test (used, s))
+    problem ("sector %u is used twice, again as %s of inode %u",
+             s, what, inode);
+  bit_set (used, s, true);
+  return true;
+}
+
+/* Claims pointer block S of inode INODE, which has BLOCKS blocks,
+   and everything under it.  It has LEVELS levels of blocks below
+   it and maps the SPAN blocks from block BASE on. */
+static void
+check_pointer_block (uint32_t inode, uint32_t s, int levels, size_t base,
+                     size_t span, size_t blocks, bool *past_end)
+{
+  uint32_t *table;
+  size_t i, child_span = span / INDIRECT_BLOCK_ENTRIES;
+
+  if (!claim (s, inode, "pointer block"))
+    return;
+  table = sector (s);
+  for (i = 0; i < INDIRECT_BLOCK_ENTRIES; i++)
+    {
+      if (table[i] == 0)
+        continue;
+      if (base + i * child_span >= blocks && !*past_end)
+        {
+          problem ("inode %u: maps blocks past its end", inode);
+          *past_end = true;
+        }
+      if (levels == 1)
+        claim (table[i], inode, "data block");
+      else
+        check_pointer_block (inode, table[i], levels - 1,
+                             base + i * child_span, child_span, blocks,
+                             past_end);
+    }
+}
+
+/* Checks the inode at sector S and claims its sectors.  Returns
+   the inode, or a null pointer if it is not a valid inode, in
+   which case nothing is claimed. */
+static struct inode_disk *
+check_inode (uint32_t s, const char *path)
+{
+  struct inode_disk *inode = get_inode (s);
+  size_t blocks, i, base, span;
+  bool past_end = false;
+  int levels;
+
+  if (inode == NULL)
+    {
+      problem ("%s: sector %u is not an inode", path, s);
+      return NULL;
+    }
+  if (inode->self_sector != s || inode->length < 0
+      || inode->length > MAX_FILE_SIZE || inode->is_dir > 1
+      || (inode->flags & ~INODE_INLINE) != 0
+      || ((inode->flags & INODE_INLINE)
+          && inode->length > INODE_INLINE_SIZE))
+    {
+      problem ("%s: inode %u is corrupt", path, s);
+      return NULL;
+    }
+
+  claim (s, s, "inode");
+  if (inode->flags & INODE_INLINE)
+    return inode;
+  blocks = DIV_ROUND_UP (inode->length, SECTOR_SIZE);
+  for (i = 0; i < DIRECT_BLOCK_ENTRIES; i++)
+    if (inode->map.direct[i] != 0)
+      {
+        if (i >= blocks && !past_end)
+          {
+            problem ("inode %u: maps blocks past its end", s);
+            past_end = true;
+          }
+        claim (inode->map.direct[i], s, "data block");
+      }
+  base = DIRECT_BLOCK_ENTRIES;
+  span = 1;
+  for (levels = 1; levels <= BLOCK_MAP_LEVELS; levels++)
+    {
+      span *= INDIRECT_BLOCK_ENTRIES;
+      if (inode->map.roots[levels - 1] != 0)
+        check_pointer_block (s, inode->map.roots[levels - 1], levels, base,
+                             span, blocks, &past_end);
+      base += span;
+    }
+  return inode;
+}
+
+/* A directory waiting to be checked. */
+struct pending_dir
+  {
+    uint32_t sector;
+    char *path;
+  };
+
+/* Checks the entries of directory DIR, at PATH, and the inodes
+   they name.  Subdirectories are appended to QUEUE.  With REPAIR,
+   entries naming bad or already linked inodes are cleared. */
+static void
+check_dir (struct inode_disk *dir, const char *path,
+           struct pending_dir *queue, size_t *queue_cnt, bool repair)
+{
+  struct dir_entry *entries = read_file (dir);
+  size_t cnt = dir->length / sizeof *entries;
+  bool changed = false;
+  size_t i;
+
+  if (dir->length % sizeof *entries != 0)
+    problem ("%s/: length %d is not a whole number of entries",
+             path, dir->length);
+  for (i = 0; i < cnt; i++)
+    {
+      struct dir_entry *e = &entries[i];
+      struct inode_disk *child;
+      char *child_path;
+      bool bad = false;
+
+      if (e->in_use > 1)
+        problem ("%s/: entry %zu is corrupt", path, i);
+      if (e->in_use != 1)
+        continue;
+      if (memchr (e->name, '\0', FS_NAME_MAX + 1) == NULL || e->name[0] == '\0')
+        {
+          problem ("%s/: entry %zu has a bad name", path, i);
+          bad = true;
+        }
+      else if (!strcmp (e->name, ".") || !strcmp (e->name, ".."))
+        {
+          child = get_inode (e->inode_sector);
+          if (child == NULL || !child->is_dir)
+            {
+              problem ("%s/%s: does not name a directory", path, e->name);
+              bad = true;
+            }
+        }
+      else
+        {
+          child_path = xcalloc (1, strlen (path) + strlen (e->name) + 2);
+          sprintf (child_path, "%s/%s", path, e->name);
+          if (e->inode_sector < sector_cnt && bit_test (seen, e->inode_sector))
+            {
+              problem ("%s: inode %u is linked more than once",
+                       child_path, e->inode_sector);
+              bad = true;
+            }
+          else if ((child = check_inode (e->inode_sector, child_path)) == NULL)
+            bad = true;
+          else
+            {
+              bit_set (seen, e->inode_sector, true);
+              if (child->is_dir)
+                {
+                  queue[*queue_cnt].sector = e->inode_sector;
+                  queue[(*queue_cnt)++].path = child_path;
+                  child_path = NULL;
+                }
+            }
+          free (child_path);
+        }
+      if (bad && repair)
+        {
+          e->in_use = false;
+          changed = true;
+        }
+    }
+  if (changed)
+    file_io (dir, entries, cnt * sizeof *entries, 0, true);
+  free (entries);
+}
+
+static int
+do_fsck (bool repair)
+{
+  struct journal_super *super;
+  struct inode_disk *root, *map_inode;
+  struct pending_dir *queue;
+  size_t queue_cnt = 0, next = 0;
+  uint32_t replayed, i, s;
+  unsigned shown = 0, leaked = 0, lost = 0;
+
+  load_image ();
+  used = xcalloc (1, free_map_bytes);
+  seen = xcalloc (1, free_map_bytes);
+
+  /* look at the file system as the next boot will see it */
+  if ((replayed = replay_journal ()) != 0)
+    problem ("journal: committed transaction of %u sectors not "
+             "checkpointed%s", replayed, repair ? ", replayed" : "");
+  claim (JOURNAL_SECTOR, JOURNAL_SECTOR, "journal super block");
+  super = sector (JOURNAL_SECTOR);
+  if (super->magic != JOURNAL_SUPER_MAGIC)
+    printf ("journal: none, metadata updates are not logged\n");
+  else if (super->log_start >= sector_cnt
+           || super->log_size > sector_cnt - super->log_start)
+    problem ("journal: log at sectors %u-%u is past the end of the disk",
+             super->log_start, super->log_start + super->log_size - 1);
+  else
+    for (s = super->log_start; s < super->log_start + super->log_size; s++)
+      claim (s, JOURNAL_SECTOR, "journal log");
+
+  /* the free map file, then the tree, breadth first */
+  if ((map_inode = check_inode (FREE_MAP_SECTOR, "free map")) == NULL)
+    fatal ("%s: can't check without a free map", image_name);
+  if ((int64_t) map_inode->length < (int64_t) free_map_bytes)
+    problem ("free map: %d bytes, too short for %u sectors",
+             map_inode->length, sector_cnt);
+  bit_set (seen, FREE_MAP_SECTOR, true);
+  queue = xcalloc (sector_cnt, sizeof *queue);
+  if ((root = check_inode (ROOT_DIR_SECTOR, "/")) == NULL || !root->is_dir)
+    fatal ("%s: can't check without a root directory", image_name);
+  bit_set (seen, ROOT_DIR_SECTOR, true);
+  queue[queue_cnt].sector = ROOT_DIR_SECTOR;
+  queue[queue_cnt++].path = strdup ("");
+  while (next < queue_cnt)
+    {
+      struct pending_dir *d = &queue[next++];
+      check_dir (sector (d->sector), d->path, queue, &queue_cnt, repair);
+      free (d->path);
+    }
+  free (queue);
+
+  /* every sector found should be marked in the free map, and
+     nothing else */
+  read_free_map ();
+  for (i = 0; i < sector_cnt; i++)
+    {
+      bool marked = bit_test (free_map, i), in_use = bit_test (used, i);
+      if (in_use && !marked)
+        {
+          if (shown++ < 10)
+            problem ("free map: sector %u is in use but marked free", i);
+          else
+            problem_cnt++;
+          lost++;
+        }
+      else if (!in_use && marked)
+        leaked++;
+    }
+  if (lost > 10)
+    printf ("free map: %u sectors in use but marked free in all\n", lost);
+  if (leaked)
+    problem ("free map: %u sectors marked in use but not used%s", leaked,
+             repair ? ", freed" : "");
+
+  if (repair && problem_cnt > 0)
+    {
+      memcpy (free_map, used, free_map_bytes);
+      file_io (map_inode, free_map, free_map_bytes, 0, true);
+      save_image (false);
+    }
+  printf ("%s: %u problem%s%s\n", image_name, problem_cnt,
+          problem_cnt == 1 ? "" : "s",
+          problem_cnt && repair ? " repaired" : "");
+  free (used);
+  free (seen);
+  return problem_cnt > 0;
+}
+
+static void
+usage (int exit_code)
+{
+  fprintf (exit_code ? stderr : stdout,
+           "fsimage: builds, inspects and checks Pintos file system images\n"
+           "usage: %s mkfs IMAGE SIZE [DIR]  make a SIZE MB file system,\n"
+           "                                   copying in host directory DIR\n"
+           "       %s info IMAGE             show free space and journal\n"
+           "       %s ls IMAGE               list every file\n"
+           "       %s cat IMAGE PATH         write file PATH to stdout\n"
+           "       %s fsck [-r] IMAGE        check IMAGE, repairing with -r\n"
+           "IMAGE is a file system partition or a partitioned disk.\n"
+           "fsck exits with status 1 if it finds problems.\n",
+           program_name, program_name, program_name, program_name,
+           program_name);
+  exit (exit_code);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *command;
+
+  program_name = argv[0];
+  if (argc < 3)
+    usage (argc == 2 && !strcmp (argv[1], "-h") ? 0 : 2);
+  command = argv[1];
+
+  if (!strcmp (command, "mkfs") && (argc == 4 || argc == 5))
+    {
+      image_name = argv[2];
+      return do_mkfs (strtod (argv[3], NULL), argc == 5 ? argv[4] : NULL);
+    }
+  else if (!strcmp (command, "info") && argc == 3)
+    {
+      image_name = argv[2];
+      return do_info ();
+    }
+  else if (!strcmp (command, "ls") && argc == 3)
+    {
+      image_name = argv[2];
+      return do_ls ();
+    }
+  else if (!strcmp (command, "cat") && argc == 4)
+    {
+      image_name = argv[2];
+      return do_cat (argv[3]);
+    }
+  else if (!strcmp (command, "fsck") && (argc == 3 || argc == 4))
+    {
+      bool repair = argc == 4 && !strcmp (argv[2], "-r");
+      if (argc == 4 && !repair)
+        usage (2);
+      image_name = argv[argc - 1];
+      return do_fsck (repair);
+    }
+  usage (2);
+  return 2;
+}